@@ -0,0 +1,146 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGNMENT 8
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+// Bump allocator for everything belonging to one document. Nothing is freed
+// individually: reset_arena keeps the blocks around for the next document
+// and free_arena gives them back.
+//
+// Containers don't know their final size while they are being parsed, so
+// their items are pushed onto the scratch stack first and copied into the
+// arena in one piece once they are complete. Nested containers push on top
+// of their parent and pop before it continues.
+typedef struct {
+    ArenaBlock *first;
+    ArenaBlock *current;
+    char *scratch;
+    size_t scratch_size;
+    size_t scratch_capacity;
+} Arena;
+
+Arena create_arena() { return (Arena){0}; }
+
+ArenaBlock *create_arena_block(size_t size) {
+    ArenaBlock *b = malloc(sizeof(*b) + size);
+    STATS_ADD(arena_blocks, 1);
+    STATS_ADD(arena_bytes, size);
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+void *arena_alloc(Arena *a, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    // Blocks after current are either empty after a reset or don't exist.
+    ArenaBlock *b = a->current;
+    while (b != NULL && b->used + size > b->size)
+        b = b->next;
+
+    if (b == NULL) {
+        b = create_arena_block(size > ARENA_BLOCK_SIZE ? size
+                                                       : ARENA_BLOCK_SIZE);
+        if (a->current == NULL) {
+            a->first = b;
+        } else {
+            b->next = a->current->next;
+            a->current->next = b;
+        }
+    }
+
+    a->current = b;
+    void *result = b->data + b->used;
+    b->used += size;
+    return result;
+}
+
+void *arena_copy(Arena *a, const void *data, size_t size) {
+    void *result = arena_alloc(a, size);
+    memcpy(result, data, size);
+    return result;
+}
+
+void reset_arena(Arena *a) {
+    for (ArenaBlock *b = a->first; b != NULL; b = b->next)
+        b->used = 0;
+
+    a->current = a->first;
+    a->scratch_size = 0;
+}
+
+void free_arena(Arena *a) {
+    ArenaBlock *b = a->first;
+
+    while (b != NULL) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+
+    free(a->scratch);
+    *a = create_arena();
+}
+
+// Takes over every block of other, leaving it empty. Whatever was allocated
+// there now lives as long as a.
+void arena_adopt(Arena *a, Arena *other) {
+    ArenaBlock *last = other->first;
+
+    if (last != NULL) {
+        while (last->next != NULL)
+            last = last->next;
+
+        // Adopted blocks go in front so the ones after current stay empty.
+        if (a->current == NULL) {
+            a->first = other->first;
+            a->current = last;
+        } else {
+            last->next = a->first;
+            a->first = other->first;
+        }
+    }
+
+    free(other->scratch);
+    *other = create_arena();
+}
+
+size_t arena_scratch_mark(Arena *a) { return a->scratch_size; }
+
+void arena_scratch_push(Arena *a, const void *data, size_t size) {
+    if (a->scratch_size + size > a->scratch_capacity) {
+        size_t capacity = a->scratch_capacity ? a->scratch_capacity : 1024;
+
+        while (a->scratch_size + size > capacity)
+            capacity *= 2;
+
+        a->scratch = realloc(a->scratch, capacity);
+        a->scratch_capacity = capacity;
+    }
+
+    memcpy(a->scratch + a->scratch_size, data, size);
+    a->scratch_size += size;
+}
+
+void arena_scratch_pop(Arena *a, size_t mark) {
+    assert(mark <= a->scratch_size);
+    a->scratch_size = mark;
+}
+
+// Moves everything pushed since mark into the arena.
+void *arena_scratch_commit(Arena *a, size_t mark) {
+    size_t size = a->scratch_size - mark;
+    void *result = size ? arena_copy(a, a->scratch + mark, size) : NULL;
+    arena_scratch_pop(a, mark);
+    return result;
+}
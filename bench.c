@@ -0,0 +1,528 @@
+// Benchmarks
+//
+//   gcc -O2 -pthread bench.c -o bench && ./bench [options]
+//
+// Generates synthetic corpora into a directory, once, and runs every engine
+// over each of them. Every run happens in a child process of its own so that
+// its peak RSS can be measured, and prints one JSON object per line:
+//
+//   corpus, engine, input   what was run, input is "mapped" or "chunked"
+//   bytes, documents        size of the corpus
+//   io_s                    reading the input through the stream alone
+//   parse_s, print_s        parsing, then writing the result to /dev/null
+//   parse_mb_s, documents_s parse throughput
+//   peak_rss_kb             for the whole child, including what it starts with
+//   allocations, allocated  malloc/calloc/realloc calls and bytes requested,
+//                           during the parse
+//   result                  "parsed" or "error"
+//
+// Options:
+//   --dir=DIR       where corpora are kept, /tmp/json-bench by default
+//   --size=MB       size of every corpus, instead of their own defaults
+//   --corpus=NAME   only run this corpus, may be repeated
+//   --engine=NAME   only run this engine, may be repeated
+//
+// The record corpora repeat the items of test.json, which has to be in the
+// working directory when they are generated.
+
+#include <stdlib.h>
+#include <string.h>
+
+size_t bench_allocations = 0;
+size_t bench_allocated = 0;
+
+void bench_count(size_t size) {
+    __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&bench_allocated, size, __ATOMIC_RELAXED);
+}
+
+void *bench_malloc(size_t size) {
+    bench_count(size);
+    return malloc(size);
+}
+
+void *bench_calloc(size_t count, size_t size) {
+    bench_count(count * size);
+    return calloc(count, size);
+}
+
+void *bench_realloc(void *p, size_t size) {
+    bench_count(size);
+    return realloc(p, size);
+}
+
+#define malloc bench_malloc
+#define calloc bench_calloc
+#define realloc bench_realloc
+#define JSON_NO_MAIN
+#include "main.c"
+#undef malloc
+#undef calloc
+#undef realloc
+
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define BENCH_MB (1 << 20)
+
+// Corpora
+
+// Writes a corpus of at least the requested size and returns how many
+// documents it holds.
+typedef size_t (*Generator)(FILE *out, size_t size);
+
+size_t generate_deep(FILE *out, size_t size) {
+    fputc('[', out);
+
+    for (size_t i = 0; (size_t)ftell(out) < size; i++) {
+        fputs(i ? ",\n" : "\n", out);
+
+        for (int depth = 0; depth < 500; depth++)
+            fprintf(out, depth & 1 ? "[%d, " : "{\"k%d\": ", depth);
+
+        fputs("null", out);
+
+        for (int depth = 499; depth >= 0; depth--)
+            fputc(depth & 1 ? ']' : '}', out);
+    }
+
+    fputs("\n]\n", out);
+    return 1;
+}
+
+size_t generate_wide(FILE *out, size_t size) {
+    fputc('[', out);
+
+    for (size_t i = 0; (size_t)ftell(out) < size; i++) {
+        fputs(i ? ",\n{" : "\n{", out);
+
+        for (int key = 0; key < 10000; key++)
+            fprintf(out, "%s\"field_%d\": %d", key ? ", " : "", key, key * 7);
+
+        fputc('}', out);
+    }
+
+    fputs("\n]\n", out);
+    return 1;
+}
+
+size_t generate_strings(FILE *out, size_t size) {
+    fputc('[', out);
+
+    for (size_t i = 0; (size_t)ftell(out) < size; i++) {
+        fputs(i ? ",\n\"" : "\n\"", out);
+
+        for (int run = 0; run < 1024; run++)
+            fputs(run % 64 ? "lorem ipsum dolor sit amet, consectetur adipis "
+                             "elit, sed do eiusmod tempor "
+                           : "\\\"quoted\\\" \\u00e9\\n\\t\\\\ "
+                             "caf\xc3\xa9 \xe2\x82\xac ",
+                  out);
+
+        fputc('"', out);
+    }
+
+    fputs("\n]\n", out);
+    return 1;
+}
+
+size_t generate_numbers(FILE *out, size_t size) {
+    uint64_t x = 88172645463325252ULL;
+
+    fputc('[', out);
+
+    for (size_t i = 0; (size_t)ftell(out) < size; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+
+        if (i)
+            fputs(i % 16 ? ", " : ",\n", out);
+
+        if (i & 1)
+            fprintf(out, "%.17g", (double)(int64_t)x / 1e9);
+        else
+            fprintf(out, "%lld", (long long)((int64_t)x >> (x & 31)));
+    }
+
+    fputs("]\n", out);
+    return 1;
+}
+
+// The items of test.json, compact, to repeat.
+List_char records = {0};
+List_size_t record_ends = {0};
+
+void load_records() {
+    if (records.data != NULL)
+        return;
+
+    FILE *f = fopen("test.json", "r");
+
+    if (f == NULL) {
+        fprintf(stderr, "test.json not found\n");
+        exit(1);
+    }
+
+    Stream s = create_file_stream(f);
+    Json j;
+
+    if (parse_json(&s, &j) != PARSED || j.variant != ARRAY ||
+        j.value.j_array.size == 0) {
+        fprintf(stderr, "test.json is not an array of records\n");
+        exit(1);
+    }
+
+    Writer w = create_writer(NULL, 0);
+    JsonHandler h = writer_handler(&w);
+
+    record_ends = create_list_size_t(j.value.j_array.size);
+
+    for (size_t i = 0; i < j.value.j_array.size; i++) {
+        emit_json(&j.value.j_array.data[i], &h);
+        record_ends.data[record_ends.size++] = w.size;
+    }
+
+    records = (List_char){.data = w.data, .size = w.size};
+    free_stream(&s);
+    fclose(f);
+}
+
+size_t write_records(FILE *out, size_t size, const char *separator) {
+    size_t count = 0;
+
+    load_records();
+
+    for (; (size_t)ftell(out) < size; count++) {
+        size_t i = count % record_ends.size;
+        size_t start = i ? record_ends.data[i - 1] : 0;
+
+        if (count)
+            fputs(separator, out);
+
+        fwrite(records.data + start, 1, record_ends.data[i] - start, out);
+    }
+
+    return count;
+}
+
+size_t generate_records(FILE *out, size_t size) {
+    fputs("[\n", out);
+    write_records(out, size, ",\n");
+    fputs("\n]\n", out);
+    return 1;
+}
+
+size_t generate_ndjson(FILE *out, size_t size) {
+    size_t count = write_records(out, size, "\n");
+
+    fputc('\n', out);
+    return count;
+}
+
+typedef struct {
+    const char *name;
+    Generator generate;
+    size_t default_mb;
+    int ndjson;
+    // An array of test.json's records, which the schema engine needs.
+    int records;
+} Corpus;
+
+Corpus corpora[] = {
+    {"deep", generate_deep, 64, 0, 0},
+    {"wide", generate_wide, 64, 0, 0},
+    {"strings", generate_strings, 64, 0, 0},
+    {"numbers", generate_numbers, 64, 0, 0},
+    {"records", generate_records, 1024, 0, 1},
+    {"ndjson", generate_ndjson, 256, 1, 0},
+};
+
+// Engines
+
+typedef enum {
+    ENGINE_RECURSIVE,
+    ENGINE_STRUCTURAL,
+    ENGINE_PARALLEL,
+    ENGINE_TAPE,
+    ENGINE_VALIDATE,
+    ENGINE_NDJSON,
+    ENGINE_SCHEMA,
+} EngineKind;
+
+typedef struct {
+    const char *name;
+    EngineKind kind;
+    int chunked;
+} Engine;
+
+Engine engines[] = {
+    {"recursive", ENGINE_RECURSIVE, 0}, {"recursive", ENGINE_RECURSIVE, 1},
+    {"structural", ENGINE_STRUCTURAL, 0}, {"parallel", ENGINE_PARALLEL, 0},
+    {"tape", ENGINE_TAPE, 0},           {"validate", ENGINE_VALIDATE, 0},
+    {"validate", ENGINE_VALIDATE, 1},   {"ndjson", ENGINE_NDJSON, 0},
+    {"schema", ENGINE_SCHEMA, 0},       {"schema", ENGINE_SCHEMA, 1},
+};
+
+#define COUNT(a) (sizeof(a) / sizeof(*(a)))
+
+double now() {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+Stream open_input(FILE *f, int chunked) {
+    rewind(f);
+    return chunked ? create_chunked_stream(f, STREAM_CHUNK_SIZE)
+                   : create_file_stream(f);
+}
+
+volatile char io_sink;
+
+// Reads every byte through the stream, the way the parsers do, touching one
+// per cache line.
+double time_io(FILE *f, int chunked) {
+    Stream s = open_input(f, chunked);
+    double start = now();
+    char sum = 0;
+
+    while (stream_ensure(&s, 1)) {
+        size_t available = s.size - s.current_position;
+        char *p = s.data + (s.current_position - s.offset);
+
+        for (size_t i = 0; i < available; i += 64)
+            sum ^= p[i];
+
+        s.current_position += available;
+    }
+
+    double elapsed = now() - start;
+
+    io_sink = sum;
+    free_stream(&s);
+    return elapsed;
+}
+
+typedef struct {
+    double parse;
+    double print;
+    ParseResult result;
+} Timing;
+
+Timing time_engine(FILE *f, Engine *e, Writer *w) {
+    Stream s = open_input(f, e->chunked);
+    JsonHandler out = writer_handler(w);
+    JsonHandler none = {0};
+    Timing t = {0};
+    Json j;
+    Schema_Person_ARRAY people;
+    Tape tape = create_tape();
+    double start = now();
+
+    switch (e->kind) {
+    case ENGINE_RECURSIVE:
+        t.result = parse_json(&s, &j);
+        break;
+    case ENGINE_STRUCTURAL:
+        t.result = parse_json_structural(&s, &j);
+        break;
+    case ENGINE_PARALLEL:
+        t.result = parse_json_parallel(&s, &j);
+        break;
+    case ENGINE_TAPE:
+        t.result = parse_tape(&s, &tape);
+        break;
+    case ENGINE_VALIDATE:
+        t.result = parse_events(&s, &none);
+        break;
+    case ENGINE_NDJSON:
+        t.result = parse_ndjson(&s, w, parallel_threads, 1) ? ERROR : PARSED;
+        break;
+    case ENGINE_SCHEMA:
+        t.result = parse_schema_Person_ARRAY(&s, &people);
+        break;
+    }
+
+    t.parse = now() - start;
+    start = now();
+
+    if (t.result == PARSED && e->kind == ENGINE_NDJSON) {
+        // Lines are written as they are parsed, so writing is timed as the
+        // difference to a second run that does both.
+        free_stream(&s);
+        s = open_input(f, e->chunked);
+        parse_ndjson(&s, w, parallel_threads, 0);
+        writer_flush(w);
+        start += t.parse;
+    } else if (t.result == PARSED && e->kind != ENGINE_VALIDATE &&
+               e->kind != ENGINE_SCHEMA) {
+        if (e->kind == ENGINE_TAPE)
+            emit_tape(&tape, 0, &out);
+        else
+            emit_json(&j, &out);
+
+        writer_flush(w);
+    }
+
+    t.print = now() - start;
+    free_tape(&tape);
+    free_stream(&s);
+    return t;
+}
+
+void run_case(Corpus *c, Engine *e, const char *path, size_t documents) {
+    FILE *f = fopen(path, "r");
+    FILE *null = fopen("/dev/null", "w");
+    Writer w = create_writer(null, 2);
+    struct stat st;
+
+    fstat(fileno(f), &st);
+
+    double io = time_io(f, e->chunked);
+
+    bench_allocations = 0;
+    bench_allocated = 0;
+
+    Timing t = time_engine(f, e, &w);
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    free_writer(&w);
+    fclose(null);
+    fclose(f);
+
+    printf("{\"corpus\": \"%s\", \"engine\": \"%s\", \"input\": \"%s\", "
+           "\"bytes\": %lld, \"documents\": %zu, \"io_s\": %.6f, "
+           "\"parse_s\": %.6f, \"print_s\": %.6f, \"parse_mb_s\": %.1f, "
+           "\"documents_s\": %.1f, \"peak_rss_kb\": %ld, "
+           "\"allocations\": %zu, \"allocated\": %zu, \"result\": \"%s\"}\n",
+           c->name, e->name, e->chunked ? "chunked" : "mapped",
+           (long long)st.st_size, documents, io, t.parse, t.print,
+           st.st_size / t.parse / BENCH_MB, documents / t.parse,
+           usage.ru_maxrss, bench_allocations, bench_allocated,
+           t.result == PARSED ? "parsed" : "error");
+    fflush(stdout);
+}
+
+// Generates the corpus unless a file of that size is already there, and
+// returns its document count.
+size_t prepare_corpus(Corpus *c, const char *path, size_t size) {
+    char count_path[4096];
+    size_t documents = 0;
+    struct stat st;
+
+    snprintf(count_path, sizeof(count_path), "%s.documents", path);
+    FILE *counts = fopen(count_path, "r");
+
+    if (counts != NULL) {
+        if (fscanf(counts, "%zu", &documents) != 1)
+            documents = 0;
+
+        fclose(counts);
+    }
+
+    if (documents && stat(path, &st) == 0 && (size_t)st.st_size >= size)
+        return documents;
+
+    fprintf(stderr, "generating %s (%zu MB)\n", path, size / BENCH_MB);
+
+    FILE *out = fopen(path, "w");
+
+    if (out == NULL) {
+        fprintf(stderr, "can't write %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    documents = c->generate(out, size);
+    fclose(out);
+
+    counts = fopen(count_path, "w");
+    fprintf(counts, "%zu\n", documents);
+    fclose(counts);
+    return documents;
+}
+
+int selected(char **names, int count, const char *name) {
+    if (count == 0)
+        return 1;
+
+    for (int i = 0; i < count; i++)
+        if (!strcmp(names[i], name))
+            return 1;
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *dir = "/tmp/json-bench";
+    size_t size_mb = 0;
+    char *corpus_names[COUNT(corpora)];
+    char *engine_names[COUNT(engines)];
+    int corpus_count = 0;
+    int engine_count = 0;
+
+    init_simd();
+
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--dir=", 6))
+            dir = argv[i] + 6;
+        else if (!strncmp(argv[i], "--size=", 7))
+            size_mb = strtoull(argv[i] + 7, NULL, 10);
+        else if (!strncmp(argv[i], "--corpus=", 9) &&
+                 corpus_count < (int)COUNT(corpora))
+            corpus_names[corpus_count++] = argv[i] + 9;
+        else if (!strncmp(argv[i], "--engine=", 9) &&
+                 engine_count < (int)COUNT(engines))
+            engine_names[engine_count++] = argv[i] + 9;
+        else {
+            fprintf(stderr, "unknown option '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+
+    mkdir(dir, 0755);
+    parallel_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (size_t c = 0; c < COUNT(corpora); c++) {
+        Corpus *corpus = &corpora[c];
+        char path[4096];
+
+        if (!selected(corpus_names, corpus_count, corpus->name))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s.json", dir, corpus->name);
+        size_t documents = prepare_corpus(
+            corpus, path, (size_mb ? size_mb : corpus->default_mb) * BENCH_MB);
+
+        for (size_t e = 0; e < COUNT(engines); e++) {
+            Engine *engine = &engines[e];
+
+            if ((engine->kind == ENGINE_NDJSON) != corpus->ndjson ||
+                (engine->kind == ENGINE_SCHEMA && !corpus->records) ||
+                !selected(engine_names, engine_count, engine->name))
+                continue;
+
+            // Each run in a fresh process, so peak RSS is its own.
+            pid_t pid = fork();
+
+            if (pid == 0) {
+                run_case(corpus, engine, path, documents);
+                _exit(0);
+            }
+
+            int status;
+            waitpid(pid, &status, 0);
+
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                fprintf(stderr, "%s/%s crashed\n", corpus->name, engine->name);
+        }
+    }
+
+    free(records.data);
+    free_list_size_t(&record_ends);
+    return 0;
+}
@@ -0,0 +1,131 @@
+// Iteration
+//
+// Goes through the items of one array in a document, parsing each into a
+// Json of its own. Everything the stream's arena holds is released before
+// the next item is parsed, and a chunked stream drops input behind the
+// parser, so memory stays bounded by the largest item rather than growing
+// with the array. Only the KeyTable keeps growing, with the distinct keys.
+//
+// The array is found by a path in either syntax --select takes, without
+// wildcards. Values on the way to it are skipped unparsed, and whatever
+// follows it is never read.
+
+typedef struct {
+    Stream *stream;
+    int first;
+    ParseResult result;
+} ArrayIterator;
+
+// Moves past the members of the object at the current position up to the
+// value of the one called step->key.
+ParseResult iterator_find_member(Stream *s, PathStep *step) {
+    JsonString key;
+
+    if (!eat_char(s, '{'))
+        return ERROR;
+
+    for (int first = 1;; first = 0) {
+        if (!first && !eat_char_between_whitespace(s, ','))
+            return ERROR;
+
+        eat_whitespace(s);
+
+        if (parse_key(s, &key) != PARSED ||
+            !eat_char_between_whitespace(s, ':'))
+            return ERROR;
+
+        if (key_equals(&key, step->key, step->size))
+            return PARSED;
+
+        if (skip_value(s) != PARSED)
+            return ERROR;
+    }
+}
+
+// Moves past the items of the array at the current position up to the one
+// at step->index.
+ParseResult iterator_find_item(Stream *s, PathStep *step) {
+    if (!eat_char(s, '['))
+        return ERROR;
+
+    for (size_t i = 0; i < step->index; i++) {
+        if (skip_value(s) != PARSED || !eat_char_between_whitespace(s, ','))
+            return ERROR;
+    }
+
+    eat_whitespace(s);
+    return PARSED;
+}
+
+// Finds the array at path, NULL or "" for the root, and sets it up to be
+// iterated. A path that doesn't lead to an array is an error at wherever it
+// stops matching.
+ParseResult array_iterator_start(ArrayIterator *it, Stream *s,
+                                 const char *path) {
+    List_PathStep steps = create_list_PathStep(0);
+    ParseResult result = PARSED;
+    char c;
+
+    *it = (ArrayIterator){.stream = s, .first = 1, .result = PARSED};
+
+    if (path != NULL && *path == '$')
+        result = parse_dotted_path(path + 1, &steps) ? PARSED : ERROR;
+    else if (path != NULL)
+        result = parse_pointer(path, &steps) ? PARSED : ERROR;
+
+    for (size_t i = 0; i < steps.size && result == PARSED; i++) {
+        PathStep *step = &steps.data[i];
+
+        eat_whitespace(s);
+
+        if (step->any || !stream_peek(s, &c))
+            result = ERROR;
+        else if (c == '{' && step->key != NULL)
+            result = iterator_find_member(s, step);
+        else if (c == '[' && step->index != SIZE_MAX)
+            result = iterator_find_item(s, step);
+        else
+            result = ERROR;
+    }
+
+    for (size_t i = 0; i < steps.size; i++)
+        free(steps.data[i].key);
+
+    free_list_PathStep(&steps);
+    eat_whitespace(s);
+
+    if (result != PARSED || !eat_char(s, '['))
+        it->result = ERROR;
+
+    reset_arena(&s->arena);
+    return it->result;
+}
+
+// Releases the previous item and parses the next one into out. Returns
+// PARSED with an item, NOT_PARSED after the last one, or ERROR.
+ParseResult array_iterator_next(ArrayIterator *it, Json *out) {
+    Stream *s = it->stream;
+
+    if (it->result != PARSED)
+        return it->result;
+
+    reset_arena(&s->arena);
+
+    if (!it->first && !eat_char_between_whitespace(s, ',')) {
+        it->result = eat_char_between_whitespace(s, ']') ? NOT_PARSED : ERROR;
+        return it->result;
+    }
+
+    it->first = 0;
+
+    // An empty array, or a trailing comma.
+    if (eat_char_between_whitespace(s, ']')) {
+        it->result = NOT_PARSED;
+        return it->result;
+    }
+
+    if (parse_json(s, out) != PARSED)
+        it->result = ERROR;
+
+    return it->result;
+}
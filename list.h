@@ -1,5 +1,10 @@
 #define LIST_NAME(ty) List_##ty
 
+// Counted when stats.c is included first and built with JSON_STATS.
+#ifndef STATS_LIST
+#define STATS_LIST(type, counter, amount) ((void)0)
+#endif
+
 #define LIST(ty)                                                               \
     typedef struct {                                                           \
         ty *data;                                                              \
@@ -7,30 +12,67 @@
         size_t capacity;                                                       \
     } LIST_NAME(ty)
 
+// A list's first allocation holds at least a cache line of items, unless
+// it was created with a larger capacity.
+#define LIST_MIN_CAPACITY(ty) (sizeof(ty) < 64 ? 64 / sizeof(ty) : 1)
+
+// A capacity of 0 allocates nothing until the first append.
 #define CREATE_LIST(ty)                                                        \
     LIST_NAME(ty) create_list_##ty(size_t capacity) {                          \
-        ty *data = malloc(sizeof(*data) * capacity);                           \
         LIST_NAME(ty) l;                                                       \
-        l.data = data;                                                         \
+        STATS_LIST(ty, creates, 1);                                            \
+        STATS_LIST(ty, bytes, sizeof(ty) * capacity);                          \
+        l.data = capacity ? malloc(sizeof(ty) * capacity) : NULL;              \
         l.size = 0;                                                            \
         l.capacity = capacity;                                                 \
         return l;                                                              \
     }
 
+// Growth goes through realloc, which can often extend the block in place.
 #define APPEND_LIST(ty)                                                        \
     void append_list_##ty(LIST_NAME(ty) * l, ty t) {                           \
-        if (l->size + 1 > l->capacity) {                                       \
-            int new_capacity = 2 * l->capacity;                                \
-            ty *data = malloc(sizeof(*data) * new_capacity);                   \
-            memcpy(data, l->data, l->size);                                    \
-            free(l->data);                                                     \
-            l->data = data;                                                    \
+        if (l->size == l->capacity) {                                          \
+            size_t new_capacity =                                              \
+                l->capacity ? 2 * l->capacity : LIST_MIN_CAPACITY(ty);         \
+            STATS_LIST(ty, growths, 1);                                        \
+            STATS_LIST(ty, bytes, sizeof(ty) * new_capacity);                  \
+            l->data = realloc(l->data, sizeof(ty) * new_capacity);             \
             l->capacity = new_capacity;                                        \
         }                                                                      \
         l->data[l->size] = t;                                                  \
         l->size += 1;                                                          \
     }
 
+// Makes room for count more items, for callers that write into l->data
+// directly.
+#define RESERVE_LIST(ty)                                                       \
+    void reserve_list_##ty(LIST_NAME(ty) * l, size_t count) {                  \
+        if (l->size + count > l->capacity) {                                   \
+            size_t new_capacity =                                              \
+                l->capacity ? l->capacity : LIST_MIN_CAPACITY(ty);             \
+            while (l->size + count > new_capacity)                             \
+                new_capacity *= 2;                                             \
+            STATS_LIST(ty, growths, 1);                                        \
+            STATS_LIST(ty, bytes, sizeof(ty) * new_capacity);                  \
+            l->data = realloc(l->data, sizeof(ty) * new_capacity);             \
+            l->capacity = new_capacity;                                        \
+        }                                                                      \
+    }
+
+// Gives back the unused part of a list that is done growing.
+#define SHRINK_LIST(ty)                                                        \
+    void shrink_list_##ty(LIST_NAME(ty) * l) {                                 \
+        if (l->size == l->capacity)                                            \
+            return;                                                            \
+        if (l->size == 0) {                                                    \
+            free(l->data);                                                     \
+            l->data = NULL;                                                    \
+        } else {                                                               \
+            l->data = realloc(l->data, sizeof(ty) * l->size);                  \
+        }                                                                      \
+        l->capacity = l->size;                                                 \
+    }
+
 #define FREE_LIST(ty)                                                          \
     void free_list_##ty(LIST_NAME(ty) * l) { free(l->data); }
 
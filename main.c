@@ -1,698 +1,2928 @@
-#include "list.h"
-#include "utils.c"
-#include <assert.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-// Stream
-typedef struct {
-    char *data;
-    size_t current_position;
-    size_t size;
-    FILE *source;
-} Stream;
-
-Stream create_static_stream(char *input) {
-    size_t input_len = strlen(input);
-    List_char list = create_list_char(input_len);
-    memcpy(list.data, input, input_len);
-    list.size = input_len;
-
-    return (Stream){.data = list.data,
-                    .size = list.size,
-                    .current_position = 0,
-                    .source = NULL};
-}
-
-List_char read_file_chunk(FILE *fstream) {
-    char buffer[1024];
-    size_t read_amount = fread(&buffer, sizeof(char), 1024, fstream);
-
-    if (read_amount == 0) {
-        List_char chunk;
-        chunk.data = NULL;
-        chunk.size = 0;
-        chunk.capacity = 0;
-        return chunk;
-    } else {
-        List_char chunk = create_list_char(read_amount);
-        memcpy(chunk.data, &buffer, read_amount);
-        chunk.size = read_amount;
-        return chunk;
-    }
-}
-
-Stream create_file_stream(FILE *fstream) {
-    return (Stream){
-        .data = NULL, .size = 0, .current_position = 0, .source = fstream};
-}
-
-int consume_stream(Stream *s, size_t amount, char *out) {
-    if (s->current_position + amount > s->size) {
-        if (s->source != NULL) {
-            List_char next_chunk = read_file_chunk(s->source);
-            if (next_chunk.size >= amount) {
-                char *data =
-                    malloc(sizeof(*data) * (s->size + next_chunk.size));
-                memcpy(data, s->data, s->size);
-                memcpy(data + s->size, next_chunk.data, next_chunk.size);
-                s->data = data;
-                s->size += next_chunk.size;
-                free_list_char(&next_chunk);
-            } else {
-                free_list_char(&next_chunk);
-                return 0;
-            }
-        } else {
-            return 0;
-        }
-    }
-
-    assert(s->current_position + amount <= s->size);
-
-    for (size_t i = 0; i < amount; ++i) {
-        out[i] = s->data[s->current_position + i];
-    }
-
-    s->current_position += amount;
-    return 1;
-}
-
-void stream_back(Stream *s, size_t amount) {
-    assert(s->current_position >= amount);
-    s->current_position -= amount;
-}
-
-int conditional_eat(Stream *stream, int (*p)(char *)) {
-    char test;
-
-    if (consume_stream(stream, 1, (char *)&test)) {
-        if (p(&test))
-            return 1;
-
-        stream_back(stream, 1);
-    }
-
-    return 0;
-}
-
-int eat_char(Stream *stream, char c) {
-    char test;
-
-    if (consume_stream(stream, 1, (char *)&test)) {
-        if (c == test)
-            return 1;
-
-        stream_back(stream, 1);
-    }
-
-    return 0;
-}
-
-void eat_whitespace(Stream *s) {
-    while (conditional_eat(s, whitespace))
-        ;
-}
-
-int eat_char_between_whitespace(Stream *stream, char c) {
-    int result = 0;
-
-    eat_whitespace(stream);
-    result = eat_char(stream, c);
-
-    if (result)
-        eat_whitespace(stream);
-
-    return result;
-}
-
-void display_error(Stream *s) {
-    printf("%s error: %s unexpected value '%c'\n", RED, NO_COLOUR,
-           s->data[s->current_position]);
-
-    long delta = 20;
-    long from_position = (long)s->current_position - delta < 0
-                             ? 0
-                             : (long)s->current_position - delta;
-    long to_position = (long)s->current_position + delta > (long)s->size
-                           ? s->size
-                           : s->current_position + delta;
-
-    printf("  |  ");
-    for (long i = from_position; i < to_position; i++) {
-        char c = s->data[i];
-        if (i == (long)s->current_position) {
-            printf("%s", BLUE);
-
-            if (c != '\n')
-                printf("%c", c);
-
-            printf("%s", NO_COLOUR);
-        } else {
-            if (c != '\n')
-                printf("%c", c);
-        }
-    }
-
-    printf("\n  |  %s", BLUE);
-    for (long i = from_position; i < (long)s->current_position - 1; i++)
-        printf("~");
-
-    printf("^\n%s", NO_COLOUR);
-}
-
-// Json
-typedef enum { PARSED, NOT_PARSED, ERROR } ParseResult;
-
-struct Json;
-
-typedef struct KeyValuePair {
-    char *key;
-    struct Json *value;
-} KeyValuePair;
-
-LIST(KeyValuePair);
-CREATE_LIST(KeyValuePair);
-APPEND_LIST(KeyValuePair);
-FREE_LIST(KeyValuePair);
-
-typedef enum {
-    OBJECT,
-    STRING,
-    NUMBER,
-    ARRAY,
-    TRUE,
-    FALSE,
-    J_NULL
-} JsonVariantType;
-
-typedef struct Json {
-    JsonVariantType variant;
-    union {
-        struct {
-            long value;
-        } j_number;
-        List_char j_string;
-        struct {
-            struct Json *data;
-            size_t size;
-            size_t capacity;
-        } j_array;
-        List_KeyValuePair j_object;
-    } value;
-} Json;
-
-LIST(Json);
-CREATE_LIST(Json);
-APPEND_LIST(Json);
-FREE_LIST(Json);
-
-ParseResult parse_json(Stream *stream, Json *out);
-
-ParseResult parse_null(Stream *stream, Json *out) {
-    size_t null_size = 4;
-    char test[null_size];
-
-    if (consume_stream(stream, null_size, (char *)&test)) {
-        if (!strncmp("null", (char *)&test, null_size)) {
-            out->variant = J_NULL;
-            return PARSED;
-        } else {
-            stream_back(stream, null_size);
-        }
-    }
-
-    return NOT_PARSED;
-}
-
-ParseResult parse_true(Stream *stream, Json *out) {
-    size_t true_size = 4;
-    char test[true_size];
-
-    if (consume_stream(stream, true_size, (char *)&test)) {
-        if (!strncmp("true", (char *)&test, true_size)) {
-            out->variant = TRUE;
-            return PARSED;
-        } else {
-            stream_back(stream, true_size);
-        }
-    }
-
-    return NOT_PARSED;
-}
-
-ParseResult parse_false(Stream *stream, Json *out) {
-    size_t false_size = 5;
-    char test[false_size];
-
-    if (consume_stream(stream, false_size, (char *)&test)) {
-        if (!strncmp("false", (char *)&test, false_size)) {
-            out->variant = FALSE;
-            return PARSED;
-        } else {
-            stream_back(stream, false_size);
-        }
-    }
-
-    return NOT_PARSED;
-}
-
-ParseResult parse_number(Stream *stream, Json *out) {
-    size_t original_position = stream->current_position;
-    List_char s = create_list_char(100);
-    ParseResult result = PARSED;
-    char test;
-    long sign = 1;
-
-    if (consume_stream(stream, 1, &test)) {
-        test == '-' ? sign = -1 : stream_back(stream, 1);
-
-        while (consume_stream(stream, 1, &test)) {
-            if (char_is_digit(test)) {
-                append_list_char(&s, test);
-            } else {
-                stream_back(stream, 1);
-                break;
-            }
-        }
-    } else {
-        result = NOT_PARSED;
-    }
-
-    if (result == PARSED && s.size > 0) {
-        out->variant = NUMBER;
-        out->value.j_number.value = sign * atol(s.data);
-    } else {
-        result =
-            original_position != stream->current_position ? ERROR : NOT_PARSED;
-    }
-
-    free_list_char(&s);
-    return result;
-}
-
-ParseResult parse_string(Stream *stream, Json *out) {
-    ParseResult result = PARSED;
-    char test;
-
-    if (eat_char(stream, '"')) {
-        List_char s = create_list_char(100);
-
-        while (!eat_char(stream, '"')) {
-            if (consume_stream(stream, 1, &test)) {
-                append_list_char(&s, test);
-            } else {
-                result = ERROR;
-                break;
-            }
-        }
-
-        if (result == PARSED) {
-            out->variant = STRING;
-            out->value.j_string = s;
-        } else {
-            free_list_char(&s);
-        }
-    } else {
-        result = NOT_PARSED;
-    }
-
-    return result;
-}
-
-ParseResult parse_array(Stream *stream, Json *out) {
-    ParseResult result = PARSED;
-    Json test;
-
-    if (eat_char_between_whitespace(stream, '[')) {
-        List_Json j = create_list_Json(100);
-
-        while (!eat_char_between_whitespace(stream, ']')) {
-            ParseResult inner_result = parse_json(stream, &test);
-
-            if (inner_result == PARSED) {
-                append_list_Json(&j, test);
-
-                if (!eat_char_between_whitespace(stream, ',')) {
-                    result = eat_char_between_whitespace(stream, ']') ? PARSED
-                                                                      : ERROR;
-                    break;
-                }
-            } else {
-                result = ERROR;
-                break;
-            }
-        }
-
-        if (result == PARSED) {
-            out->variant = ARRAY;
-            out->value.j_array.size = j.size;
-            out->value.j_array.capacity = j.size;
-            out->value.j_array.data = j.data;
-        } else {
-            free_list_Json(&j);
-        }
-    } else {
-        result = NOT_PARSED;
-    }
-
-    return result;
-}
-
-ParseResult parse_key_value_pair(Stream *stream, KeyValuePair *kvp) {
-    ParseResult result = PARSED;
-    Json key;
-
-    if (parse_string(stream, &key) == PARSED) {
-        assert(key.variant == STRING);
-        Json *value = malloc(sizeof(*value));
-
-        if (eat_char_between_whitespace(stream, ':')) {
-            result = parse_json(stream, value);
-        } else {
-            result = ERROR;
-        }
-
-        if (result == PARSED) {
-            size_t key_size = key.value.j_string.size;
-            char *k = malloc(sizeof(*k) * (key_size + 1));
-            memcpy(k, key.value.j_string.data, key_size);
-            k[key_size] = '\0';
-            kvp->key = k;
-            kvp->value = value;
-        } else {
-            free(value);
-        }
-    } else {
-        result = NOT_PARSED;
-    };
-
-    return result;
-}
-
-ParseResult parse_object(Stream *stream, Json *out) {
-    ParseResult result = PARSED;
-    KeyValuePair test;
-
-    if (eat_char_between_whitespace(stream, '{')) {
-        List_KeyValuePair l = create_list_KeyValuePair(100);
-
-        while (!eat_char_between_whitespace(stream, '}')) {
-            ParseResult inner_result = parse_key_value_pair(stream, &test);
-
-            if (inner_result == PARSED) {
-                append_list_KeyValuePair(&l, test);
-
-                if (!eat_char_between_whitespace(stream, ',')) {
-                    result = eat_char_between_whitespace(stream, '}') ? PARSED
-                                                                      : ERROR;
-                    break;
-                }
-            } else {
-                result = ERROR;
-                break;
-            }
-        }
-
-        if (result == PARSED) {
-            out->variant = OBJECT;
-            out->value.j_object = l;
-        } else {
-            free_list_KeyValuePair(&l);
-        }
-    } else {
-        result = NOT_PARSED;
-    }
-
-    return result;
-}
-
-ParseResult parse_json(Stream *s, Json *out) {
-    if (s->data != NULL && s->current_position == s->size)
-        return ERROR;
-
-    ParseResult result = PARSED;
-
-    eat_whitespace(s);
-
-    result = parse_null(s, out);
-
-    if (result != NOT_PARSED)
-        return result;
-
-    result = parse_true(s, out);
-
-    if (result != NOT_PARSED)
-        return result;
-
-    result = parse_false(s, out);
-
-    if (result != NOT_PARSED)
-        return result;
-
-    result = parse_number(s, out);
-
-    if (result != NOT_PARSED)
-        return result;
-
-    result = parse_string(s, out);
-
-    if (result != NOT_PARSED)
-        return result;
-
-    result = parse_array(s, out);
-
-    if (result != NOT_PARSED)
-        return result;
-
-    result = parse_object(s, out);
-
-    if (s->current_position != s->size && result != PARSED)
-        result = ERROR;
-
-    return result;
-}
-
-void not_pretty_print(Json *json, int depth) {
-    if (depth > 0)
-        depth += 2;
-
-    int inner_depth = depth + 2;
-    int previous_depth = depth - 2 >= 0 ? depth - 2 : 0;
-
-    switch (json->variant) {
-    case OBJECT:
-        printf("{\n");
-        for (size_t i = 0; i < json->value.j_object.size; i++) {
-            printf("%*c\"%s\": ", inner_depth, ' ',
-                   json->value.j_object.data[i].key);
-            not_pretty_print(json->value.j_object.data[i].value, inner_depth);
-
-            if (i != json->value.j_object.size - 1)
-                printf(",\n");
-        }
-        printf("\n%*c}", previous_depth, ' ');
-        break;
-    case STRING:
-        printf("\"%s\"", json->value.j_string.data);
-        break;
-    case NUMBER:
-        printf("%ld", json->value.j_number.value);
-        break;
-    case ARRAY:
-        printf("[\n");
-        for (size_t i = 0; i < json->value.j_array.size; i++) {
-            printf("%*c", inner_depth, ' ');
-            not_pretty_print(&json->value.j_array.data[i], inner_depth);
-
-            if (i != json->value.j_array.size - 1)
-                printf(",\n");
-        }
-        printf("\n%*c]", previous_depth, ' ');
-        break;
-    case TRUE:
-        printf("true");
-        break;
-    case FALSE:
-        printf("false");
-        break;
-    case J_NULL:
-        printf("null");
-        break;
-    }
-}
-
-// Tests
-void test_null(char *input, ParseResult result) {
-    Stream s = create_static_stream(input);
-    Json j;
-
-    ParseResult test_result = parse_null(&s, &j);
-    assert(test_result == result);
-
-    if (test_result == PARSED)
-        assert(j.variant == J_NULL);
-}
-
-void test_true(char *input, ParseResult result) {
-    Stream s = create_static_stream(input);
-    Json j;
-
-    ParseResult test_result = parse_true(&s, &j);
-    assert(test_result == result);
-
-    if (test_result == PARSED)
-        assert(j.variant == TRUE);
-}
-
-void test_false(char *input, ParseResult result) {
-    Stream s = create_static_stream(input);
-    Json j;
-
-    ParseResult test_result = parse_false(&s, &j);
-    assert(test_result == result);
-
-    if (test_result == PARSED)
-        assert(j.variant == FALSE);
-}
-
-void test_number(char *input, long value, ParseResult result) {
-    Stream s = create_static_stream(input);
-    Json j;
-
-    ParseResult test_result = parse_number(&s, &j);
-    assert(test_result == result);
-
-    if (test_result == PARSED) {
-        assert(j.variant == NUMBER);
-        assert(j.value.j_number.value == value);
-    }
-}
-
-void test_array(char *input, ParseResult result) {
-    Stream s = create_static_stream(input);
-    Json j;
-
-    ParseResult test_result = parse_array(&s, &j);
-    assert(test_result == result);
-
-    if (test_result == PARSED)
-        assert(j.variant == ARRAY);
-}
-
-void test_object(char *input, ParseResult result) {
-    Stream s = create_static_stream(input);
-    Json j;
-
-    ParseResult test_result = parse_object(&s, &j);
-    assert(test_result == result);
-
-    if (test_result == PARSED)
-        assert(j.variant == OBJECT);
-}
-
-void test_json(char *input, ParseResult result) {
-    Stream s = create_static_stream(input);
-    Json j;
-
-    assert(parse_json(&s, &j) == result);
-}
-
-void test_string(char *input, ParseResult result) {
-    Stream s = create_static_stream(input);
-    Json j;
-
-    ParseResult test_result = parse_string(&s, &j);
-    assert(test_result == result);
-
-    if (test_result == PARSED)
-        assert(j.variant == STRING);
-}
-
-int run_tests() {
-    test_null("null", PARSED);
-    test_null("nul", NOT_PARSED);
-    test_null("", NOT_PARSED);
-
-    test_true("true", PARSED);
-    test_true("truue", NOT_PARSED);
-    test_true("", NOT_PARSED);
-
-    test_false("false", PARSED);
-    test_false("falze", NOT_PARSED);
-    test_false("", NOT_PARSED);
-
-    test_number("1", 1, PARSED);
-    test_number("2", 2, PARSED);
-    test_number("0", 0, PARSED);
-    test_number("-", 0, ERROR);
-    test_number("", -1, NOT_PARSED);
-    test_number("-1", -1, PARSED);
-    test_number("-1235235", -1235235, PARSED);
-
-    test_string("\"h ahahaah\"", PARSED);
-    test_string("", NOT_PARSED);
-    test_string("\"ahhahaha", ERROR);
-
-    test_array("[],", PARSED);
-    test_array("[", ERROR);
-    test_array("]", NOT_PARSED);
-    test_array("[1,2]", PARSED);
-    test_array("[1,true,2]", PARSED);
-    test_array("[1,true,2   ]", PARSED);
-    test_array("[\t\n\t\n\n   ]", PARSED);
-    test_array("[\t\n\t\n\ntrue,\n\"ahahha\",false,   ]", PARSED);
-    test_array("[1,true,2, null, true, [], [[], [[]]]]", PARSED);
-    test_array("[1,true,2, null, true, [, [[], [[]]]]", ERROR);
-    test_array("", NOT_PARSED);
-
-    test_object("{}", PARSED);
-    test_object("{", ERROR);
-    test_object("}", NOT_PARSED);
-    test_object("{\"key\":1}", PARSED);
-    test_object("{\"key\":1, \"name\":   \"adrian\", \"arr\": [1,2]}", PARSED);
-    test_object("{\"key\":1, \"name:   \"adrian\", \"arr\": [1,2]}", ERROR);
-
-    test_json("", ERROR);
-    test_json("1", PARSED);
-    test_json("true", PARSED);
-    test_json("false", PARSED);
-    test_json("null", PARSED);
-    test_json("[]", PARSED);
-    test_json("{}", PARSED);
-    test_json("\"asfsadf\"", PARSED);
-    test_json("{\"test\":   [2s]}", ERROR);
-    test_json("{\"test\":   [2]}", PARSED);
-    test_json("{\"test\": {\n\t}}", PARSED);
-    test_json("[{\"test\":[\n\n\t\"ahah\",\n\t\r\"test\",2]}]", PARSED);
-
-    return 1;
-}
-
-int main(int argc, char **argv) {
-    assert(run_tests());
-
-    if (argc < 2) {
-        printf("Gimmi some json");
-        return -1;
-    }
-
-    FILE *f = fopen(argv[1], "r");
-    if (f == NULL) {
-        printf("File '%s' not found\n", argv[1]);
-        return -1;
-    }
-
-    Stream s = create_file_stream(f);
-    Json j;
-    ParseResult result = parse_json(&s, &j);
-
-    if (result == PARSED) {
-        not_pretty_print(&j, 0);
-    } else {
-        display_error(&s);
-    }
-
-    return 0;
-}
+#include "stats.c"
+#include "list.h"
+#include "utils.c"
+#include "arena.c"
+#include "simd.c"
+#include "number.c"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Stream
+#define STREAM_CHUNK_SIZE 65536
+#define STREAM_LOOKBACK 64
+
+// Positions are absolute offsets into the input. File streams only keep a
+// window of it in memory: data[0] is input byte `offset`, and bytes more than
+// `lookback` behind current_position are dropped on the next refill.
+typedef struct {
+    char *data;
+    size_t current_position;
+    size_t size;
+    size_t offset;
+    size_t capacity;
+    size_t chunk_size;
+    size_t lookback;
+    FILE *source;
+    int mapped;
+    Arena arena;
+    struct KeyTable *keys;
+} Stream;
+
+struct KeyTable *create_key_table();
+void free_key_table(struct KeyTable *t);
+
+Stream create_static_stream(char *input) {
+    size_t input_len = strlen(input);
+    // One more than needed, so that even empty input has a buffer.
+    List_char list = create_list_char(input_len + 1);
+    memcpy(list.data, input, input_len);
+    list.size = input_len;
+
+    return (Stream){.data = list.data,
+                    .size = list.size,
+                    .capacity = list.size,
+                    .current_position = 0,
+                    .offset = 0,
+                    .source = NULL,
+                    .keys = create_key_table()};
+}
+
+Stream create_chunked_stream(FILE *fstream, size_t chunk_size) {
+    return (Stream){.data = NULL,
+                    .size = 0,
+                    .capacity = 0,
+                    .current_position = 0,
+                    .offset = 0,
+                    .chunk_size = chunk_size,
+                    .lookback = STREAM_LOOKBACK,
+                    .source = fstream,
+                    .keys = create_key_table()};
+}
+
+// The whole file is visible at once and nothing is copied; the stream
+// behaves exactly like a static one.
+Stream create_mapped_stream(int fd, size_t size) {
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (data == MAP_FAILED)
+        return (Stream){.data = NULL};
+
+    // Advice values are not flags, so each one takes a call of its own.
+    madvise(data, size, MADV_SEQUENTIAL);
+    madvise(data, size, MADV_WILLNEED);
+
+    return (Stream){.data = data,
+                    .size = size,
+                    .capacity = size,
+                    .current_position = 0,
+                    .offset = 0,
+                    .source = NULL,
+                    .mapped = 1,
+                    .keys = create_key_table()};
+}
+
+// Regular files are mapped, anything else (pipes, stdin, empty files) is
+// read in chunks.
+Stream create_file_stream(FILE *fstream) {
+    struct stat st;
+
+    if (fstat(fileno(fstream), &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > 0) {
+        Stream s = create_mapped_stream(fileno(fstream), st.st_size);
+
+        if (s.data != NULL)
+            return s;
+    }
+
+    return create_chunked_stream(fstream, STREAM_CHUNK_SIZE);
+}
+
+// Releases the input and every Json parsed from it.
+void free_stream(Stream *s) {
+    free_arena(&s->arena);
+
+    if (s->keys != NULL)
+        free_key_table(s->keys);
+
+    if (s->mapped)
+        munmap(s->data, s->capacity);
+    else
+        free(s->data);
+
+    s->data = NULL;
+    s->capacity = 0;
+    s->keys = NULL;
+}
+
+// Slides the window forward past everything older than the lookback and
+// reads the next chunk in behind what is left.
+int refill_stream(Stream *s) {
+    size_t keep_from = s->current_position - s->offset > s->lookback
+                           ? s->current_position - s->lookback
+                           : s->offset;
+    size_t drop = keep_from - s->offset;
+    size_t kept = s->size - keep_from;
+
+    if (drop > 0) {
+        memmove(s->data, s->data + drop, kept);
+        s->offset = keep_from;
+    }
+
+    if (kept + s->chunk_size > s->capacity) {
+        s->capacity = kept + s->chunk_size;
+        s->data = realloc(s->data, s->capacity);
+    }
+
+    size_t read_amount =
+        fread(s->data + kept, sizeof(char), s->chunk_size, s->source);
+    STATS_ADD(refills, 1);
+    STATS_ADD(refill_bytes, read_amount);
+    s->size += read_amount;
+
+    return read_amount > 0;
+}
+
+int stream_ensure(Stream *s, size_t amount) {
+    while (s->size - s->current_position < amount) {
+        if (s->source == NULL || !refill_stream(s))
+            return 0;
+    }
+
+    return 1;
+}
+
+char stream_byte(Stream *s, size_t position) {
+    assert(position >= s->offset && position < s->size);
+    return s->data[position - s->offset];
+}
+
+int consume_stream(Stream *s, size_t amount, char *out) {
+    if (!stream_ensure(s, amount))
+        return 0;
+
+    memcpy(out, s->data + (s->current_position - s->offset), amount);
+    s->current_position += amount;
+    STATS_ADD(consumes, 1);
+    STATS_ADD(consumed_bytes, amount);
+    return 1;
+}
+
+int stream_peek(Stream *s, char *out) {
+    if (!stream_ensure(s, 1))
+        return 0;
+
+    *out = stream_byte(s, s->current_position);
+    return 1;
+}
+
+void stream_back(Stream *s, size_t amount) {
+    assert(s->current_position - s->offset >= amount);
+    s->current_position -= amount;
+    STATS_ADD(backs, 1);
+    STATS_ADD(backtracked_bytes, amount);
+}
+
+int conditional_eat(Stream *stream, int (*p)(char *)) {
+    char test;
+
+    if (consume_stream(stream, 1, (char *)&test)) {
+        if (p(&test))
+            return 1;
+
+        stream_back(stream, 1);
+    }
+
+    return 0;
+}
+
+int eat_char(Stream *stream, char c) {
+    char test;
+
+    if (consume_stream(stream, 1, (char *)&test)) {
+        if (c == test)
+            return 1;
+
+        stream_back(stream, 1);
+    }
+
+    return 0;
+}
+
+// Compares the first four bytes as a single word; literal is one of the
+// JSON keywords so size is 4 or 5.
+int eat_literal(Stream *stream, const char *literal, size_t size) {
+    uint32_t expected, actual;
+
+    if (!stream_ensure(stream, size))
+        return 0;
+
+    char *p = stream->data + (stream->current_position - stream->offset);
+    memcpy(&expected, literal, 4);
+    memcpy(&actual, p, 4);
+
+    if (actual != expected || (size > 4 && p[4] != literal[4]))
+        return 0;
+
+    stream->current_position += size;
+    return 1;
+}
+
+void eat_whitespace(Stream *s) {
+    do {
+        size_t available = s->size - s->current_position;
+
+        if (available == 0)
+            continue;
+
+        char *p = s->data + (s->current_position - s->offset);
+
+        if (!whitespace(p))
+            return;
+
+        size_t skipped = skip_whitespace(p, available);
+        s->current_position += skipped;
+
+        if (skipped < available)
+            return;
+    } while (stream_ensure(s, 1));
+}
+
+int eat_char_between_whitespace(Stream *stream, char c) {
+    int result = 0;
+
+    eat_whitespace(stream);
+    result = eat_char(stream, c);
+
+    if (result)
+        eat_whitespace(stream);
+
+    return result;
+}
+
+void display_error_to(FILE *out, Stream *s) {
+    long delta = 20;
+    stream_ensure(s, delta);
+
+    if (s->current_position < s->size)
+        fprintf(out, "%s error: %s unexpected value '%c'\n", RED, NO_COLOUR,
+               stream_byte(s, s->current_position));
+    else
+        fprintf(out, "%s error: %s unexpected end of input\n", RED, NO_COLOUR);
+
+    long from_position = (long)s->current_position - delta < (long)s->offset
+                             ? (long)s->offset
+                             : (long)s->current_position - delta;
+    long to_position = (long)s->current_position + delta > (long)s->size
+                           ? (long)s->size
+                           : (long)s->current_position + delta;
+
+    fprintf(out, "  |  ");
+    for (long i = from_position; i < to_position; i++) {
+        char c = stream_byte(s, i);
+        if (i == (long)s->current_position) {
+            fprintf(out, "%s", BLUE);
+
+            if (c != '\n')
+                fputc(c, out);
+
+            fprintf(out, "%s", NO_COLOUR);
+        } else {
+            if (c != '\n')
+                fputc(c, out);
+        }
+    }
+
+    fprintf(out, "\n  |  %s", BLUE);
+    for (long i = from_position; i < (long)s->current_position - 1; i++)
+        fputc('~', out);
+
+    fprintf(out, "^\n%s", NO_COLOUR);
+}
+
+void display_error(Stream *s) { display_error_to(stdout, s); }
+
+// Json
+// NEED_MORE is only returned by the push parser.
+typedef enum { PARSED, NOT_PARSED, ERROR, ABORTED, NEED_MORE } ParseResult;
+
+// Deepest nesting any parser accepts, so that hostile input can't exhaust
+// the stack or memory. Set by --max-depth, up to JSON_MAX_DEPTH_LIMIT: the
+// tree walkers and printers recurse once per level, and at that depth they
+// stay within a couple of MB of stack.
+#define JSON_MAX_DEPTH 1024
+#define JSON_MAX_DEPTH_LIMIT 10000
+
+size_t json_max_depth = JSON_MAX_DEPTH;
+
+struct Json;
+
+// A string exactly as it appears between its quotes, escapes included.
+// Streams that hold the whole input point straight into it; chunked ones
+// copy the string into the arena.
+typedef struct {
+    const char *data;
+    size_t size;
+    int escaped;
+    // Keys read through a KeyTable are numbered from 1; other strings are 0.
+    uint32_t id;
+} JsonString;
+
+// Keys
+//
+// Every distinct key read through a stream is stored once in its KeyTable,
+// so equal keys share their bytes and can be compared by id. Keys copied
+// out of chunked streams are kept in the table's own arena, which lives as
+// long as the stream rather than the document.
+//
+// Records tend to repeat their keys in the same order, so the table also
+// remembers which key followed each one last time and tries that before
+// hashing.
+typedef struct KeyTable {
+    JsonString *keys;
+    uint32_t *next;
+    uint32_t *slots;
+    size_t count;
+    size_t capacity;
+    uint32_t last;
+    Arena arena;
+} KeyTable;
+
+#define KEY_TABLE_SIZE 64
+
+KeyTable *create_key_table() {
+    KeyTable *t = calloc(1, sizeof(KeyTable));
+
+    t->capacity = KEY_TABLE_SIZE;
+    t->slots = calloc(t->capacity, sizeof(uint32_t));
+    t->keys = malloc(sizeof(JsonString) * t->capacity / 2);
+    t->next = calloc(t->capacity / 2 + 1, sizeof(uint32_t));
+    return t;
+}
+
+void free_key_table(KeyTable *t) {
+    free(t->keys);
+    free(t->next);
+    free(t->slots);
+    free_arena(&t->arena);
+    free(t);
+}
+
+void grow_key_table(KeyTable *t) {
+    size_t capacity = t->capacity * 2;
+    uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+
+    for (size_t id = 1; id <= t->count; id++) {
+        JsonString *key = &t->keys[id - 1];
+        size_t slot = hash_bytes(key->data, key->size) & (capacity - 1);
+
+        while (slots[slot] != 0)
+            slot = (slot + 1) & (capacity - 1);
+
+        slots[slot] = id;
+    }
+
+    free(t->slots);
+    t->slots = slots;
+    t->capacity = capacity;
+    t->keys = realloc(t->keys, sizeof(JsonString) * capacity / 2);
+    t->next = realloc(t->next, sizeof(uint32_t) * (capacity / 2 + 1));
+    memset(t->next + t->capacity / 4 + 1, 0,
+           sizeof(uint32_t) * (capacity / 2 - capacity / 4));
+}
+
+// The stored copy of key, which is added if it is new. copy says whether
+// key's bytes go away and have to be copied first.
+JsonString intern_key(KeyTable *t, JsonString key, int copy) {
+    uint32_t predicted = t->next[t->last];
+
+    if (predicted != 0) {
+        JsonString *stored = &t->keys[predicted - 1];
+
+        if (stored->size == key.size &&
+            !memcmp(stored->data, key.data, key.size)) {
+            t->last = predicted;
+            return *stored;
+        }
+    }
+
+    if (2 * (t->count + 1) > t->capacity)
+        grow_key_table(t);
+
+    size_t mask = t->capacity - 1;
+    size_t slot = hash_bytes(key.data, key.size) & mask;
+
+    for (; t->slots[slot] != 0; slot = (slot + 1) & mask) {
+        JsonString *stored = &t->keys[t->slots[slot] - 1];
+
+        if (stored->size == key.size &&
+            !memcmp(stored->data, key.data, key.size)) {
+            t->next[t->last] = stored->id;
+            t->last = stored->id;
+            return *stored;
+        }
+    }
+
+    if (copy)
+        key.data = arena_copy(&t->arena, key.data, key.size);
+
+    key.id = ++t->count;
+    t->keys[key.id - 1] = key;
+    t->slots[slot] = key.id;
+    t->next[t->last] = key.id;
+    t->last = key.id;
+    return key;
+}
+
+typedef struct KeyValuePair {
+    JsonString key;
+    struct Json *value;
+} KeyValuePair;
+
+LIST(KeyValuePair);
+CREATE_LIST(KeyValuePair);
+APPEND_LIST(KeyValuePair);
+FREE_LIST(KeyValuePair);
+
+// Members in document order. index is a hash table of their positions,
+// built by json_object_get when it is first needed.
+typedef struct {
+    KeyValuePair *data;
+    size_t size;
+    uint32_t *index;
+} JsonObject;
+
+typedef enum {
+    OBJECT,
+    STRING,
+    NUMBER,
+    ARRAY,
+    TRUE,
+    FALSE,
+    J_NULL
+} JsonVariantType;
+
+typedef struct Json {
+    JsonVariantType variant;
+    union {
+        JsonNumber j_number;
+        JsonString j_string;
+        struct {
+            struct Json *data;
+            size_t size;
+            size_t capacity;
+        } j_array;
+        JsonObject j_object;
+    } value;
+} Json;
+
+LIST(Json);
+CREATE_LIST(Json);
+APPEND_LIST(Json);
+FREE_LIST(Json);
+
+int json_string_equals(JsonString s, const char *other) {
+    return s.size == strlen(other) && !memcmp(s.data, other, s.size);
+}
+
+unsigned int read_hex4(const char *p) {
+    unsigned int value = 0;
+
+    for (int i = 0; i < 4; i++)
+        value = value << 4 | hex_digit_value(p[i]);
+
+    return value;
+}
+
+int is_hex4(const char *p, const char *end) {
+    if (end - p < 4)
+        return 0;
+
+    for (int i = 0; i < 4; i++)
+        if (hex_digit_value(p[i]) < 0)
+            return 0;
+
+    return 1;
+}
+
+// Escapes are only decoded when someone asks for the value. Strings without
+// any are returned as they are; the rest are decoded into the arena, which
+// never needs more room than the escaped form.
+JsonString decode_json_string(JsonString s, Arena *arena) {
+    if (!s.escaped)
+        return s;
+
+    const char *p = s.data;
+    const char *end = s.data + s.size;
+    char *out = arena_alloc(arena, s.size + 1);
+    size_t size = 0;
+
+    while (p < end) {
+        size_t run = find_string_special(p, end - p);
+
+        memcpy(out + size, p, run);
+        size += run;
+        p += run;
+
+        if (p == end)
+            break;
+
+        if (*p != '\\' || p + 1 == end) {
+            out[size++] = *p++;
+            continue;
+        }
+
+        char c = p[1];
+        p += 2;
+
+        switch (c) {
+        case 'b':
+            out[size++] = '\b';
+            break;
+        case 'f':
+            out[size++] = '\f';
+            break;
+        case 'n':
+            out[size++] = '\n';
+            break;
+        case 'r':
+            out[size++] = '\r';
+            break;
+        case 't':
+            out[size++] = '\t';
+            break;
+        case 'u':
+            if (!is_hex4(p, end)) {
+                out[size++] = c;
+                break;
+            }
+
+            unsigned int code_point = read_hex4(p);
+            p += 4;
+
+            if (code_point >= 0xD800 && code_point < 0xDC00 &&
+                end - p >= 6 && p[0] == '\\' && p[1] == 'u' &&
+                is_hex4(p + 2, end)) {
+                unsigned int low = read_hex4(p + 2);
+
+                if (low >= 0xDC00 && low < 0xE000) {
+                    code_point =
+                        0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+            }
+
+            size += utf8_encode(code_point, out + size);
+            break;
+        default:
+            out[size++] = c;
+            break;
+        }
+    }
+
+    out[size] = '\0';
+    return (JsonString){.data = out, .size = size, .escaped = 0};
+}
+
+// Length of the escape at p, backslash included, or 0 if it is cut off
+// after size bytes or isn't valid. A \u escape for a high surrogate is only
+// valid followed by one for a low surrogate, so that decoding always gives
+// UTF-8.
+size_t escape_length(const char *p, size_t size) {
+    if (size < 2)
+        return 0;
+
+    switch (p[1]) {
+    case '"':
+    case '\\':
+    case '/':
+    case 'b':
+    case 'f':
+    case 'n':
+    case 'r':
+    case 't':
+        return 2;
+    case 'u':
+        break;
+    default:
+        return 0;
+    }
+
+    if (!is_hex4(p + 2, p + size))
+        return 0;
+
+    unsigned int code_point = read_hex4(p + 2);
+
+    if (code_point < 0xD800 || code_point >= 0xE000)
+        return 6;
+
+    if (code_point >= 0xDC00 || size < 12 || p[6] != '\\' || p[7] != 'u' ||
+        !is_hex4(p + 8, p + size))
+        return 0;
+
+    code_point = read_hex4(p + 8);
+    return code_point >= 0xDC00 && code_point < 0xE000 ? 12 : 0;
+}
+
+// Length of the valid UTF-8 at p, up to the next ASCII byte.
+size_t utf8_run_length(const char *p, size_t size) {
+    size_t i = 0;
+    int length;
+
+    while (i < size && (unsigned char)p[i] >= 0x80 &&
+           (length = utf8_length((const unsigned char *)p + i, size - i)))
+        i += length;
+
+    return i;
+}
+
+// Checks the contents of a string that is all in memory, with the quotes
+// left out. Returns the offset of the first byte that makes it invalid, or
+// size if there is none, and sets *escaped if it has any escapes.
+size_t check_json_string(const char *p, size_t size, int *escaped) {
+    size_t i = 0;
+
+    *escaped = 0;
+
+    while ((i += find_string_check(p + i, size - i)) < size) {
+        size_t length;
+
+        if (p[i] == '\\') {
+            length = escape_length(p + i, size - i);
+            *escaped = 1;
+        } else {
+            length = utf8_run_length(p + i, size - i);
+        }
+
+        if (length == 0)
+            return i;
+
+        i += length;
+    }
+
+    return size;
+}
+
+// Events
+//
+// The parser reports what it finds to a JsonHandler instead of building
+// anything itself. Callbacks that are left NULL are skipped, and one that
+// returns 0 stops the parse with ABORTED. Strings and numbers are only valid
+// for the duration of the call unless the stream holds the whole input.
+typedef struct {
+    void *context;
+    int (*start_object)(void *context);
+    int (*end_object)(void *context);
+    int (*start_array)(void *context);
+    int (*end_array)(void *context);
+    int (*key)(void *context, JsonString *key);
+    int (*string)(void *context, JsonString *value);
+    int (*number)(void *context, JsonNumber *value);
+    int (*boolean)(void *context, int value);
+    int (*null)(void *context);
+} JsonHandler;
+
+#define EMIT(h, event, ...)                                                    \
+    ((h)->event == NULL || (h)->event((h)->context, ##__VA_ARGS__))
+
+ParseResult parse_events(Stream *stream, JsonHandler *h);
+
+// Objects
+//
+// Small objects are searched in order. Larger ones get an open-addressing
+// table of member positions plus one, with 0 marking a free slot, sized to
+// the smallest power of two that keeps it at most half full. Objects above
+// JSON_OBJECT_EAGER_SIZE are indexed as soon as they are parsed, the rest
+// on their first lookup. Keys are compared as they appear in the document.
+#define JSON_OBJECT_SCAN_SIZE 8
+#define JSON_OBJECT_EAGER_SIZE 1024
+
+size_t object_index_slots(size_t size) {
+    size_t slots = 16;
+
+    while (slots < 2 * size)
+        slots *= 2;
+
+    return slots;
+}
+
+int key_equals(JsonString *key, const char *other, size_t size) {
+    return key->size == size && !memcmp(key->data, other, size);
+}
+
+void index_object(Arena *arena, JsonObject *object) {
+    size_t mask = object_index_slots(object->size) - 1;
+    uint32_t *index = arena_alloc(arena, sizeof(uint32_t) * (mask + 1));
+
+    memset(index, 0, sizeof(uint32_t) * (mask + 1));
+
+    for (size_t i = 0; i < object->size; i++) {
+        JsonString *key = &object->data[i].key;
+        size_t slot = hash_bytes(key->data, key->size) & mask;
+
+        // The first of several members with the same key wins.
+        while (index[slot] != 0 &&
+               !key_equals(&object->data[index[slot] - 1].key, key->data,
+                           key->size))
+            slot = (slot + 1) & mask;
+
+        if (index[slot] == 0)
+            index[slot] = i + 1;
+    }
+
+    object->index = index;
+}
+
+void index_large_object(Arena *arena, JsonObject *object) {
+    if (object->size >= JSON_OBJECT_EAGER_SIZE)
+        index_object(arena, object);
+}
+
+// Value of the first member called key, or NULL. The index is allocated
+// from arena, which should be the one the object was parsed into.
+Json *json_object_get(Arena *arena, Json *json, const char *key,
+                      size_t size) {
+    JsonObject *object = &json->value.j_object;
+
+    assert(json->variant == OBJECT);
+
+    if (object->size <= JSON_OBJECT_SCAN_SIZE) {
+        for (size_t i = 0; i < object->size; i++)
+            if (key_equals(&object->data[i].key, key, size))
+                return object->data[i].value;
+
+        return NULL;
+    }
+
+    if (object->index == NULL)
+        index_object(arena, object);
+
+    size_t mask = object_index_slots(object->size) - 1;
+    size_t slot = hash_bytes(key, size) & mask;
+
+    for (; object->index[slot] != 0; slot = (slot + 1) & mask) {
+        KeyValuePair *member = &object->data[object->index[slot] - 1];
+
+        if (key_equals(&member->key, key, size))
+            return member->value;
+    }
+
+    return NULL;
+}
+
+ParseResult parse_null(Stream *stream, Json *out) {
+    if (!eat_literal(stream, "null", 4))
+        return NOT_PARSED;
+
+    out->variant = J_NULL;
+    return PARSED;
+}
+
+ParseResult parse_true(Stream *stream, Json *out) {
+    if (!eat_literal(stream, "true", 4))
+        return NOT_PARSED;
+
+    out->variant = TRUE;
+    return PARSED;
+}
+
+ParseResult parse_false(Stream *stream, Json *out) {
+    if (!eat_literal(stream, "false", 5))
+        return NOT_PARSED;
+
+    out->variant = FALSE;
+    return PARSED;
+}
+
+ParseResult parse_number(Stream *stream, Json *out) {
+    size_t length = 0;
+    char *p;
+
+    // Make sure the whole number is in the window before converting it.
+    while (1) {
+        size_t available = stream->size - stream->current_position;
+        p = stream->data + (stream->current_position - stream->offset);
+
+        while (length < available && is_number_byte(p[length]))
+            ++length;
+
+        if (length < available || !stream_ensure(stream, length + 1))
+            break;
+    }
+
+    if (length == 0)
+        return NOT_PARSED;
+
+    p = stream->data + (stream->current_position - stream->offset);
+
+    size_t used;
+    int parsed = parse_number_text(p, length, &out->value.j_number, &used);
+
+    stream->current_position += used;
+
+    if (!parsed)
+        return ERROR;
+
+    out->variant = NUMBER;
+    return PARSED;
+}
+
+// Escapes and UTF-8 are checked here, but escapes are only decoded later by
+// decode_json_string. Runs of plain ASCII are skipped by find_string_check.
+// On an error the position is left at the escape or byte that is invalid.
+//
+// Chunked streams drop input behind the parser, so there the bytes are
+// copied onto the scratch stack instead, and out->data is left for the
+// caller to point at wherever it keeps them.
+ParseResult read_string(Stream *stream, JsonString *out) {
+    ParseResult result = PARSED;
+
+    if (eat_char(stream, '"')) {
+        int copy = stream->source != NULL;
+        Arena *arena = &stream->arena;
+        size_t mark = arena_scratch_mark(arena);
+        size_t start = stream->current_position;
+        size_t end = start;
+        int escaped = 0;
+
+        while (1) {
+            if (!stream_ensure(stream, 1)) {
+                result = ERROR;
+                break;
+            }
+
+            char *p = stream->data + (stream->current_position - stream->offset);
+            size_t available = stream->size - stream->current_position;
+            size_t run = find_string_check(p, available);
+
+            if (copy && run > 0)
+                arena_scratch_push(arena, p, run);
+            stream->current_position += run;
+
+            if (run == available)
+                continue;
+
+            if (p[run] == '"') {
+                end = stream->current_position;
+                stream->current_position += 1;
+                break;
+            }
+
+            size_t length;
+
+            if (p[run] == '\\') {
+                // Room for a surrogate pair, if the input goes on that far.
+                stream_ensure(stream, 12);
+                p = stream->data + (stream->current_position - stream->offset);
+                available = stream->size - stream->current_position;
+                length = escape_length(p, available);
+                escaped = 1;
+            } else {
+                p += run;
+                available -= run;
+                length = utf8_run_length(p, available);
+
+                // A sequence cut off by the end of the chunk is looked at
+                // again once the rest of it is in.
+                if (length == 0 && available < 4 && stream_ensure(stream, 4))
+                    continue;
+            }
+
+            if (length == 0) {
+                result = ERROR;
+                break;
+            }
+
+            if (copy)
+                arena_scratch_push(arena, p, length);
+            stream->current_position += length;
+        }
+
+        if (result == PARSED) {
+            out->size = end - start;
+            out->escaped = escaped;
+            out->id = 0;
+            out->data = copy ? NULL : stream->data + (start - stream->offset);
+        } else {
+            arena_scratch_pop(arena, mark);
+        }
+    } else {
+        result = NOT_PARSED;
+    }
+
+    return result;
+}
+
+ParseResult parse_string(Stream *stream, Json *out) {
+    int copy = stream->source != NULL;
+    size_t mark = arena_scratch_mark(&stream->arena);
+    ParseResult result = read_string(stream, &out->value.j_string);
+
+    if (result == PARSED) {
+        out->variant = STRING;
+
+        if (copy)
+            out->value.j_string.data =
+                arena_scratch_commit(&stream->arena, mark);
+    }
+
+    return result;
+}
+
+// Keys are interned when the stream has a KeyTable, which saves copying
+// the ones that repeat out of chunked streams.
+ParseResult parse_key(Stream *stream, JsonString *out) {
+    int copy = stream->source != NULL;
+    Arena *arena = &stream->arena;
+    size_t mark = arena_scratch_mark(arena);
+    ParseResult result = read_string(stream, out);
+
+    if (result != PARSED)
+        return result;
+
+    if (copy)
+        out->data = arena->scratch + mark;
+
+    if (stream->keys != NULL) {
+        *out = intern_key(stream->keys, *out, copy);
+
+        if (copy)
+            arena_scratch_pop(arena, mark);
+    } else if (copy) {
+        out->data = arena_scratch_commit(arena, mark);
+    }
+
+    return PARSED;
+}
+
+ParseResult parse_array(Stream *stream, Json *out);
+ParseResult parse_object(Stream *stream, Json *out);
+
+typedef ParseResult (*JsonParser)(Stream *, Json *);
+
+// Every JSON value is identified by its first byte, so parse_json never has
+// to try a production and back out of it.
+JsonParser json_parsers[256] = {
+    ['n'] = parse_null,   ['t'] = parse_true,   ['f'] = parse_false,
+    ['-'] = parse_number, ['0'] = parse_number, ['1'] = parse_number,
+    ['2'] = parse_number, ['3'] = parse_number, ['4'] = parse_number,
+    ['5'] = parse_number, ['6'] = parse_number, ['7'] = parse_number,
+    ['8'] = parse_number, ['9'] = parse_number, ['"'] = parse_string,
+    ['['] = parse_array,  ['{'] = parse_object,
+};
+
+int emit_scalar(Json *scalar, JsonHandler *h) {
+    switch (scalar->variant) {
+    case STRING:
+        return EMIT(h, string, &scalar->value.j_string);
+    case NUMBER:
+        return EMIT(h, number, &scalar->value.j_number);
+    case TRUE:
+        return EMIT(h, boolean, 1);
+    case FALSE:
+        return EMIT(h, boolean, 0);
+    default:
+        return EMIT(h, null);
+    }
+}
+
+#define EVENTS_STACK_SIZE 64
+
+// Reads an object key and the colon after it.
+ParseResult parse_member_key(Stream *stream, JsonHandler *h) {
+    JsonString key;
+
+    if (parse_key(stream, &key) != PARSED)
+        return ERROR;
+
+    if (!EMIT(h, key, &key))
+        return ABORTED;
+
+    return eat_char_between_whitespace(stream, ':') ? PARSED : ERROR;
+}
+
+// Parses one value, reporting it to h as it goes.
+//
+// Open containers are kept on an explicit stack of their opening brackets
+// rather than the C stack, so any nesting up to json_max_depth is safe; one
+// level deeper is an error at its opening bracket.
+ParseResult parse_events(Stream *stream, JsonHandler *h) {
+    char local[EVENTS_STACK_SIZE];
+    char *open = local;
+    size_t capacity = sizeof(local);
+    size_t depth = 0;
+    ParseResult result = PARSED;
+    Json scalar;
+    char next;
+
+    while (result == PARSED) {
+        eat_whitespace(stream);
+
+        if (!stream_peek(stream, &next)) {
+            result = ERROR;
+            break;
+        }
+
+        STATS_ADD(values, 1);
+
+        if (next == '[' || next == '{') {
+            char close = next == '[' ? ']' : '}';
+
+            if (depth == json_max_depth) {
+                result = ERROR;
+                break;
+            }
+
+            if (depth == capacity) {
+                capacity *= 2;
+                open = open == local ? memcpy(malloc(capacity), local, depth)
+                                     : realloc(open, capacity);
+            }
+
+            open[depth++] = next;
+            STATS_DEPTH(depth);
+            eat_char(stream, next);
+
+            if (!(next == '[' ? EMIT(h, start_array) : EMIT(h, start_object))) {
+                result = ABORTED;
+                break;
+            }
+
+            if (!eat_char_between_whitespace(stream, close)) {
+                if (next == '{')
+                    result = parse_member_key(stream, h);
+                continue;
+            }
+
+            depth--;
+
+            if (!(next == '[' ? EMIT(h, end_array) : EMIT(h, end_object))) {
+                result = ABORTED;
+                break;
+            }
+        } else {
+            JsonParser parser = json_parsers[(unsigned char)next];
+
+            if (parser == NULL || parser(stream, &scalar) != PARSED) {
+                STATS_ADD(failed_parses, 1);
+                result = ERROR;
+                break;
+            }
+
+            if (!emit_scalar(&scalar, h)) {
+                result = ABORTED;
+                break;
+            }
+        }
+
+        // A value is complete. Move on to the next item of the container it
+        // is in, closing every container it was the last item of. A comma
+        // before the closing bracket is accepted.
+        while (depth > 0) {
+            int array = open[depth - 1] == '[';
+            char close = array ? ']' : '}';
+
+            if (eat_char_between_whitespace(stream, ',')) {
+                if (!eat_char_between_whitespace(stream, close)) {
+                    if (!array)
+                        result = parse_member_key(stream, h);
+                    break;
+                }
+            } else if (!eat_char_between_whitespace(stream, close)) {
+                result = ERROR;
+                break;
+            }
+
+            depth--;
+
+            if (!(array ? EMIT(h, end_array) : EMIT(h, end_object))) {
+                result = ABORTED;
+                break;
+            }
+        }
+
+        if (depth == 0)
+            break;
+    }
+
+    if (open != local)
+        free(open);
+
+    return result;
+}
+
+ParseResult parse_array_events(Stream *stream, JsonHandler *h) {
+    char next;
+
+    eat_whitespace(stream);
+
+    if (!stream_peek(stream, &next) || next != '[')
+        return NOT_PARSED;
+
+    return parse_events(stream, h);
+}
+
+ParseResult parse_object_events(Stream *stream, JsonHandler *h) {
+    char next;
+
+    eat_whitespace(stream);
+
+    if (!stream_peek(stream, &next) || next != '{')
+        return NOT_PARSED;
+
+    return parse_events(stream, h);
+}
+
+// Tree building
+//
+// Items of every open container sit on the arena scratch stack until the
+// container ends, and are then committed at their final size.
+typedef struct {
+    size_t mark;
+    int object;
+    JsonString key;
+} TreeFrame;
+
+LIST(TreeFrame);
+CREATE_LIST(TreeFrame);
+APPEND_LIST(TreeFrame);
+FREE_LIST(TreeFrame);
+
+typedef struct {
+    Arena *arena;
+    List_TreeFrame frames;
+    Json root;
+} TreeBuilder;
+
+int tree_add(TreeBuilder *b, Json *value) {
+    if (b->frames.size == 0) {
+        b->root = *value;
+        return 1;
+    }
+
+    TreeFrame *top = &b->frames.data[b->frames.size - 1];
+
+    if (top->object) {
+        KeyValuePair kvp = {.key = top->key};
+
+        kvp.value = arena_copy(b->arena, value, sizeof(*value));
+        arena_scratch_push(b->arena, &kvp, sizeof(kvp));
+    } else {
+        arena_scratch_push(b->arena, value, sizeof(*value));
+    }
+
+    return 1;
+}
+
+int tree_open(TreeBuilder *b, int object) {
+    TreeFrame frame = {.mark = arena_scratch_mark(b->arena), .object = object};
+    append_list_TreeFrame(&b->frames, frame);
+    return 1;
+}
+
+int tree_close(TreeBuilder *b) {
+    TreeFrame frame = b->frames.data[--b->frames.size];
+    size_t bytes = b->arena->scratch_size - frame.mark;
+    Json container;
+
+    if (frame.object) {
+        container.variant = OBJECT;
+        container.value.j_object.size = bytes / sizeof(KeyValuePair);
+        container.value.j_object.data =
+            arena_scratch_commit(b->arena, frame.mark);
+        container.value.j_object.index = NULL;
+        index_large_object(b->arena, &container.value.j_object);
+    } else {
+        container.variant = ARRAY;
+        container.value.j_array.size = bytes / sizeof(Json);
+        container.value.j_array.capacity = container.value.j_array.size;
+        container.value.j_array.data =
+            arena_scratch_commit(b->arena, frame.mark);
+    }
+
+    return tree_add(b, &container);
+}
+
+int tree_start_object(void *b) { return tree_open(b, 1); }
+int tree_start_array(void *b) { return tree_open(b, 0); }
+int tree_end(void *b) { return tree_close(b); }
+
+int tree_key(void *context, JsonString *key) {
+    TreeBuilder *b = context;
+    b->frames.data[b->frames.size - 1].key = *key;
+    return 1;
+}
+
+int tree_string(void *b, JsonString *value) {
+    Json j = {.variant = STRING, .value.j_string = *value};
+    return tree_add(b, &j);
+}
+
+int tree_number(void *b, JsonNumber *value) {
+    Json j = {.variant = NUMBER, .value.j_number = *value};
+    return tree_add(b, &j);
+}
+
+int tree_boolean(void *b, int value) {
+    Json j = {.variant = value ? TRUE : FALSE};
+    return tree_add(b, &j);
+}
+
+int tree_null(void *b) {
+    Json j = {.variant = J_NULL};
+    return tree_add(b, &j);
+}
+
+// Runs an event production with a TreeBuilder behind it.
+ParseResult build_tree(Stream *stream, Json *out,
+                       ParseResult (*production)(Stream *, JsonHandler *)) {
+    TreeBuilder b = {.arena = &stream->arena,
+                     .frames = create_list_TreeFrame(16)};
+    JsonHandler h = {.context = &b,
+                     .start_object = tree_start_object,
+                     .end_object = tree_end,
+                     .start_array = tree_start_array,
+                     .end_array = tree_end,
+                     .key = tree_key,
+                     .string = tree_string,
+                     .number = tree_number,
+                     .boolean = tree_boolean,
+                     .null = tree_null};
+    size_t mark = arena_scratch_mark(&stream->arena);
+    ParseResult result = production(stream, &h);
+
+    if (result == PARSED)
+        *out = b.root;
+    else
+        arena_scratch_pop(&stream->arena, mark);
+
+    free_list_TreeFrame(&b.frames);
+    return result;
+}
+
+ParseResult parse_array(Stream *stream, Json *out) {
+    return build_tree(stream, out, parse_array_events);
+}
+
+ParseResult parse_object(Stream *stream, Json *out) {
+    return build_tree(stream, out, parse_object_events);
+}
+
+ParseResult parse_json(Stream *stream, Json *out) {
+    return build_tree(stream, out, parse_events);
+}
+
+// Replays a parsed tree as events. Returns 0 if the handler aborted.
+int emit_json(Json *json, JsonHandler *h) {
+    switch (json->variant) {
+    case OBJECT:
+        if (!EMIT(h, start_object))
+            return 0;
+
+        for (size_t i = 0; i < json->value.j_object.size; i++) {
+            KeyValuePair *kvp = &json->value.j_object.data[i];
+
+            if (!EMIT(h, key, &kvp->key) || !emit_json(kvp->value, h))
+                return 0;
+        }
+
+        return EMIT(h, end_object);
+    case ARRAY:
+        if (!EMIT(h, start_array))
+            return 0;
+
+        for (size_t i = 0; i < json->value.j_array.size; i++)
+            if (!emit_json(&json->value.j_array.data[i], h))
+                return 0;
+
+        return EMIT(h, end_array);
+    default:
+        return emit_scalar(json, h);
+    }
+}
+
+#include "writer.c"
+
+void not_pretty_print(Json *json) {
+    Writer w = create_writer(stdout, 2);
+    JsonHandler h = writer_handler(&w);
+
+    emit_json(json, &h);
+    free_writer(&w);
+}
+
+#include "structural.c"
+#include "tape.c"
+#include "snapshot.c"
+#include "projection.c"
+#include "schema.c"
+#include "iterator.c"
+#include "push.c"
+#include "ndjson.c"
+#include "parallel.c"
+
+// Tests
+void test_null(char *input, ParseResult result) {
+    Stream s = create_static_stream(input);
+    Json j;
+
+    ParseResult test_result = parse_null(&s, &j);
+    assert(test_result == result);
+
+    if (test_result == PARSED)
+        assert(j.variant == J_NULL);
+
+    free_stream(&s);
+}
+
+void test_true(char *input, ParseResult result) {
+    Stream s = create_static_stream(input);
+    Json j;
+
+    ParseResult test_result = parse_true(&s, &j);
+    assert(test_result == result);
+
+    if (test_result == PARSED)
+        assert(j.variant == TRUE);
+
+    free_stream(&s);
+}
+
+void test_false(char *input, ParseResult result) {
+    Stream s = create_static_stream(input);
+    Json j;
+
+    ParseResult test_result = parse_false(&s, &j);
+    assert(test_result == result);
+
+    if (test_result == PARSED)
+        assert(j.variant == FALSE);
+
+    free_stream(&s);
+}
+
+void test_number(char *input, long value, ParseResult result) {
+    Stream s = create_static_stream(input);
+    Json j;
+
+    ParseResult test_result = parse_number(&s, &j);
+    assert(test_result == result);
+
+    if (test_result == PARSED) {
+        assert(j.variant == NUMBER);
+        assert(j.value.j_number.value == value);
+    }
+
+    free_stream(&s);
+}
+
+void test_double(char *input, double value) {
+    Stream s = create_static_stream(input);
+    Json j;
+
+    assert(parse_number(&s, &j) == PARSED);
+    assert(j.value.j_number.type == NUMBER_DOUBLE);
+    assert(j.value.j_number.double_value == value);
+    assert(s.current_position == s.size);
+
+    char formatted[32];
+    format_number(&j.value.j_number, formatted);
+    assert(strtod(formatted, NULL) == value);
+
+    free_stream(&s);
+}
+
+void test_format_double(double value, char *expected) {
+    char formatted[32];
+
+    assert(format_double(value, formatted) == (int)strlen(expected));
+    assert(!strcmp(formatted, expected));
+}
+
+// Doubles from every part of the range read back as themselves.
+void test_format_double_round_trip() {
+    uint64_t x = 0x9E3779B97F4A7C15ull;
+    char formatted[32];
+    double value;
+
+    for (int i = 0; i < 2000; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(&value, &x, sizeof(value));
+
+        if (!isfinite(value))
+            continue;
+
+        format_double(value, formatted);
+        assert(strtod(formatted, NULL) == value);
+    }
+}
+
+// An integer of `digits` digits, more than a double can hold, is an error
+// in every engine rather than inf.
+void test_long_integer(size_t digits, int negative) {
+    char *input = malloc(digits + 4);
+    size_t size = 0;
+    Json j;
+
+    input[size++] = '[';
+    if (negative)
+        input[size++] = '-';
+    input[size++] = '1';
+    memset(input + size, '0', digits - 1);
+    size += digits - 1;
+    input[size++] = ']';
+    input[size] = '\0';
+
+    Stream s = create_static_stream(input);
+    assert(parse_json(&s, &j) == ERROR);
+    free_stream(&s);
+
+    s = create_static_stream(input);
+    assert(parse_json_structural(&s, &j) == ERROR);
+    free_stream(&s);
+
+    s = create_static_stream(input);
+    Tape t = create_tape();
+    assert(parse_tape(&s, &t) == ERROR);
+    free_tape(&t);
+    free_stream(&s);
+
+    free(input);
+}
+
+void test_unsigned(char *input, uint64_t value) {
+    Stream s = create_static_stream(input);
+    Json j;
+
+    assert(parse_number(&s, &j) == PARSED);
+    assert(j.value.j_number.type == NUMBER_UINT);
+    assert(j.value.j_number.unsigned_value == value);
+
+    free_stream(&s);
+}
+
+void test_array(char *input, ParseResult result) {
+    Stream s = create_static_stream(input);
+    Json j;
+
+    ParseResult test_result = parse_array(&s, &j);
+    assert(test_result == result);
+
+    if (test_result == PARSED)
+        assert(j.variant == ARRAY);
+
+    free_stream(&s);
+}
+
+void test_object(char *input, ParseResult result) {
+    Stream s = create_static_stream(input);
+    Json j;
+
+    ParseResult test_result = parse_object(&s, &j);
+    assert(test_result == result);
+
+    if (test_result == PARSED)
+        assert(j.variant == OBJECT);
+
+    free_stream(&s);
+}
+
+void test_json(char *input, ParseResult result) {
+    Stream s = create_static_stream(input);
+    Json j;
+
+    assert(parse_json(&s, &j) == result);
+
+    free_stream(&s);
+}
+
+void test_string(char *input, ParseResult result) {
+    Stream s = create_static_stream(input);
+    Json j;
+
+    ParseResult test_result = parse_string(&s, &j);
+    assert(test_result == result);
+
+    if (test_result == PARSED)
+        assert(j.variant == STRING);
+
+    free_stream(&s);
+}
+
+void test_chunked_stream(char *input, size_t chunk_size, ParseResult result) {
+    FILE *f = fmemopen(input, strlen(input), "r");
+    Stream s = create_chunked_stream(f, chunk_size);
+    Json j;
+
+    assert(parse_json(&s, &j) == result);
+    assert(s.capacity <= s.lookback + 2 * chunk_size);
+
+    free_stream(&s);
+    fclose(f);
+}
+
+void test_mapped_stream(char *input, ParseResult result) {
+    FILE *f = tmpfile();
+    fputs(input, f);
+    fflush(f);
+
+    Stream s = create_file_stream(f);
+    Json j;
+
+    assert(s.mapped);
+    assert(parse_json(&s, &j) == result);
+
+    free_stream(&s);
+    fclose(f);
+}
+
+void test_arena() {
+    Arena a = create_arena();
+
+    char *first = arena_alloc(&a, 10);
+    char *second = arena_alloc(&a, 10);
+    assert(second - first == 16);
+
+    char *large = arena_alloc(&a, 4 * ARENA_BLOCK_SIZE);
+    memset(large, 'x', 4 * ARENA_BLOCK_SIZE);
+
+    reset_arena(&a);
+    assert(arena_alloc(&a, 10) == first);
+
+    size_t mark = arena_scratch_mark(&a);
+    arena_scratch_push(&a, "abc", 3);
+    char *committed = arena_scratch_commit(&a, mark);
+    assert(!strncmp(committed, "abc", 3));
+    assert(arena_scratch_mark(&a) == mark);
+
+    free_arena(&a);
+
+    Stream s = create_static_stream("{\"k\": [\"first\", [], \"second\"]}");
+    Json j;
+
+    assert(parse_json(&s, &j) == PARSED);
+    assert(json_string_equals(j.value.j_object.data[0].key, "k"));
+
+    Json *items = j.value.j_object.data[0].value->value.j_array.data;
+    assert(json_string_equals(items[0].value.j_string, "first"));
+    assert(items[1].value.j_array.size == 0);
+    assert(json_string_equals(items[2].value.j_string, "second"));
+    assert(s.arena.scratch_size == 0);
+
+    free_stream(&s);
+}
+
+void test_simd_kernels() {
+    char input[] = "    \t\r\n                              \n    x   "
+                   "a string that is longer than a single block, caf\xc3\xa9 "
+                   "\\n\" end";
+    size_t size = strlen(input);
+    size_t string_start = strchr(input, 'a') - input;
+
+    for (SimdLevel level = SIMD_SCALAR; level <= detect_simd_level();
+         level++) {
+        use_simd_level(level);
+
+        for (size_t from = 0; from < size; from++) {
+            assert(skip_whitespace(input + from, size - from) ==
+                   skip_whitespace_scalar(input + from, size - from));
+            assert(find_string_special(input + from, size - from) ==
+                   find_string_special_scalar(input + from, size - from));
+            assert(find_string_check(input + from, size - from) ==
+                   find_string_check_scalar(input + from, size - from));
+            assert(find_skip_special(input + from, size - from) ==
+                   find_skip_special_scalar(input + from, size - from));
+        }
+
+        assert(skip_whitespace(input, size) ==
+               (size_t)(strchr(input, 'x') - input));
+        assert(find_string_special(input + string_start,
+                                   size - string_start) ==
+               (size_t)(strchr(input, '\\') - input) - string_start);
+        assert(find_string_check(input + string_start,
+                                 size - string_start) ==
+               (size_t)(strchr(input, '\xc3') - input) - string_start);
+    }
+
+    use_simd_level(detect_simd_level());
+}
+
+int json_equal(Json *a, Json *b) {
+    if (a->variant != b->variant)
+        return 0;
+
+    switch (a->variant) {
+    case OBJECT:
+        if (a->value.j_object.size != b->value.j_object.size)
+            return 0;
+        for (size_t i = 0; i < a->value.j_object.size; i++) {
+            KeyValuePair *x = &a->value.j_object.data[i];
+            KeyValuePair *y = &b->value.j_object.data[i];
+            if (x->key.size != y->key.size ||
+                memcmp(x->key.data, y->key.data, x->key.size) ||
+                !json_equal(x->value, y->value))
+                return 0;
+        }
+        return 1;
+    case ARRAY:
+        if (a->value.j_array.size != b->value.j_array.size)
+            return 0;
+        for (size_t i = 0; i < a->value.j_array.size; i++)
+            if (!json_equal(&a->value.j_array.data[i],
+                            &b->value.j_array.data[i]))
+                return 0;
+        return 1;
+    case STRING:
+        return a->value.j_string.size == b->value.j_string.size &&
+               !memcmp(a->value.j_string.data, b->value.j_string.data,
+                       a->value.j_string.size);
+    case NUMBER:
+        return a->value.j_number.type == b->value.j_number.type &&
+               a->value.j_number.unsigned_value ==
+                   b->value.j_number.unsigned_value;
+    default:
+        return 1;
+    }
+}
+
+void test_structural(char *input, ParseResult result) {
+    Stream recursive = create_static_stream(input);
+    Stream structural = create_static_stream(input);
+    Json a, b;
+
+    assert(parse_json_structural(&structural, &b) == result);
+    assert(parse_json(&recursive, &a) == result);
+
+    if (result == PARSED)
+        assert(json_equal(&a, &b));
+
+    free_stream(&recursive);
+    free_stream(&structural);
+}
+
+void test_structural_error(char *input, size_t position) {
+    Stream s = create_static_stream(input);
+    Json j;
+
+    assert(parse_json_structural(&s, &j) == ERROR);
+    assert(s.current_position == position);
+
+    free_stream(&s);
+}
+
+// Repeats item into an array big enough to be split, with the byte at
+// `broken` replaced by '}' if given, and a comma after the last item if
+// trailing_comma is set.
+#define TEST_PARALLEL_MIN_SIZE 4096
+
+void test_parallel(char *item, int threads, size_t broken,
+                   int trailing_comma) {
+    size_t item_size = strlen(item);
+    size_t count = TEST_PARALLEL_MIN_SIZE / item_size + 1;
+    char *input = malloc(count * (item_size + 1) + 3);
+    size_t size = 0;
+
+    input[size++] = '[';
+    for (size_t i = 0; i < count; i++) {
+        memcpy(input + size, item, item_size);
+        size += item_size;
+        if (i + 1 < count || trailing_comma)
+            input[size++] = ',';
+    }
+    input[size++] = ']';
+    input[size] = '\0';
+
+    if (broken)
+        input[broken] = '}';
+
+    Stream a = create_static_stream(input);
+    Stream b = create_static_stream(input);
+    Json ja, jb;
+    ParseResult result = parse_json_parallel_threads(&a, &ja, threads,
+                                                    TEST_PARALLEL_MIN_SIZE);
+
+    assert(result == (broken ? ERROR : PARSED));
+    assert(parse_json(&b, &jb) == result);
+    assert(a.current_position == b.current_position);
+
+    if (result == PARSED)
+        assert(json_equal(&ja, &jb) && ja.value.j_array.size == count);
+
+    free_stream(&a);
+    free_stream(&b);
+    free(input);
+}
+
+// A root array big enough to split, whose last item nests `depth` levels
+// below it, is rejected exactly when parse_json_structural rejects it.
+void test_parallel_depth(size_t depth) {
+    size_t count = TEST_PARALLEL_MIN_SIZE / 2 + 1;
+    char *input = malloc(2 * count + 2 * depth + 2);
+    size_t size = 0;
+
+    input[size++] = '[';
+    for (size_t i = 0; i + 1 < count; i++) {
+        input[size++] = '1';
+        input[size++] = ',';
+    }
+    memset(input + size, '[', depth);
+    size += depth;
+    input[size++] = '1';
+    memset(input + size, ']', depth + 1);
+    size += depth + 1;
+    input[size] = '\0';
+
+    Stream a = create_static_stream(input);
+    Stream b = create_static_stream(input);
+    Json ja, jb;
+    ParseResult result = parse_json_structural(&b, &jb);
+
+    assert(result == (depth < json_max_depth ? PARSED : ERROR));
+    assert(parse_json_parallel_threads(&a, &ja, 3, TEST_PARALLEL_MIN_SIZE) ==
+           result);
+    assert(a.current_position == b.current_position);
+
+    free_stream(&a);
+    free_stream(&b);
+    free(input);
+}
+
+void test_object_get(size_t count) {
+    List_char text = create_list_char(16 * count + 16);
+    char key[32];
+
+    append_list_char(&text, '{');
+    for (size_t i = 0; i < count; i++) {
+        int size = snprintf(key, sizeof(key), "%s\"k%zu\": %zu", i ? ", " : "",
+                            i, i);
+        for (int c = 0; c < size; c++)
+            append_list_char(&text, key[c]);
+    }
+    // A repeated key finds its first value.
+    for (char *c = ", \"k0\": -1}"; *c; c++)
+        append_list_char(&text, *c);
+    append_list_char(&text, '\0');
+
+    Stream s = create_static_stream(text.data);
+    Json j;
+
+    assert(parse_json(&s, &j) == PARSED);
+    assert((j.value.j_object.index != NULL) ==
+           (count + 1 >= JSON_OBJECT_EAGER_SIZE));
+
+    for (size_t i = 0; i < count; i++) {
+        int size = snprintf(key, sizeof(key), "k%zu", i);
+        Json *value = json_object_get(&s.arena, &j, key, size);
+
+        assert(value != NULL && value->value.j_number.value == (long)i);
+    }
+
+    assert(json_object_get(&s.arena, &j, "k", 1) == NULL);
+    assert(json_object_get(&s.arena, &j, "missing", 7) == NULL);
+
+    free_stream(&s);
+    free_list_char(&text);
+}
+
+void test_interned_keys(JsonParser parse, size_t chunk_size) {
+    char *input = "[{\"name\": 1, \"id\": 2}, {\"id\": 3, \"name\": {\"id\": 4}}]";
+    FILE *f = fmemopen(input, strlen(input), "r");
+    Stream s = chunk_size ? create_chunked_stream(f, chunk_size)
+                          : create_static_stream(input);
+    Json j;
+
+    assert(parse(&s, &j) == PARSED);
+
+    KeyValuePair *a = j.value.j_array.data[0].value.j_object.data;
+    KeyValuePair *b = j.value.j_array.data[1].value.j_object.data;
+    KeyValuePair *c = b[1].value->value.j_object.data;
+
+    assert(json_string_equals(a[0].key, "name") && a[0].key.id != 0);
+    assert(a[0].key.id == b[1].key.id && a[0].key.data == b[1].key.data);
+    assert(a[1].key.id == b[0].key.id && a[1].key.id == c[0].key.id);
+    assert(a[0].key.id != a[1].key.id);
+    assert(s.keys->count == 2);
+
+    free_stream(&s);
+    fclose(f);
+}
+
+void test_tape() {
+    Stream s = create_static_stream(
+        "{\"name\": \"adrian\", \"tags\": [1, -2, true, null, []], "
+        "\"nested\": {\"ok\": false, \"pi\": 3.25}}");
+    Tape t = create_tape();
+
+    assert(parse_tape(&s, &t) == PARSED);
+    assert(tape_type(&t, 0) == '{');
+    assert(tape_next(&t, 0) == t.words.size);
+    assert(tape_size(&t, 0) == 3);
+
+    size_t name = tape_find_key(&t, 0, "name");
+    size_t size;
+    assert(!strcmp(tape_string(&t, name, &size), "adrian") && size == 6);
+
+    size_t tags = tape_find_key(&t, 0, "tags");
+    assert(tape_type(&t, tags) == '[' && tape_size(&t, tags) == 5);
+    size_t second = tape_next(&t, tags + 1);
+    assert(tape_number(&t, tags + 1).value == 1);
+    assert(tape_number(&t, second).value == -2);
+    assert(tape_type(&t, tape_next(&t, second)) == 't');
+
+    JsonString key = tape_json_string(&t, 1);
+    assert(key.size == 4 && key.id == 0 && !key.escaped);
+
+    size_t nested = tape_find_key(&t, 0, "nested");
+    assert(tape_type(&t, tape_find_key(&t, nested, "ok")) == 'f');
+    assert(tape_number(&t, tape_find_key(&t, nested, "pi")).double_value ==
+           3.25);
+    assert(tape_find_key(&t, 0, "missing") == 0);
+
+    free_tape(&t);
+    free_stream(&s);
+
+    s = create_static_stream("[1, {\"a\" 2}]");
+    t = create_tape();
+    IndexWalker w = {.stream = &s, .index = create_list_size_t(16)};
+    assert(tape_walk_value(&w, &t) == ERROR);
+    assert(s.current_position == 9);
+    // Every container entered is left again, even on an error.
+    assert(w.depth == 0);
+
+    free_list_size_t(&w.index);
+    free_tape(&t);
+    free_stream(&s);
+
+    s = create_static_stream("[1, {\"a\": [2,],}, ]");
+    t = create_tape();
+    assert(parse_tape(&s, &t) == PARSED);
+    assert(tape_size(&t, 0) == 2);
+
+    free_tape(&t);
+    free_stream(&s);
+}
+
+// Writes input as a snapshot and checks that the mapped tape replays the
+// same events as the tree it was written from.
+void test_snapshot(char *input) {
+    Stream s = create_static_stream(input);
+    Writer expected = create_writer(NULL, 0);
+    Writer loaded = create_writer(NULL, 0);
+    JsonHandler to_expected = writer_handler(&expected);
+    JsonHandler to_loaded = writer_handler(&loaded);
+    Tape t = create_tape();
+    FILE *f = tmpfile();
+    Json j;
+
+    assert(parse_json(&s, &j) == PARSED);
+    emit_json(&j, &to_expected);
+    tape_append_json(&t, &j);
+    assert(write_snapshot(&t, f));
+    fflush(f);
+    free_tape(&t);
+
+    assert(load_snapshot(fileno(f), &t));
+    assert(t.mapping != NULL);
+    assert(emit_tape(&t, 0, &to_loaded));
+    assert(loaded.size == expected.size &&
+           !memcmp(loaded.data, expected.data, loaded.size));
+    assert(tape_next(&t, 0) == t.words.size);
+
+    free_tape(&t);
+    free_writer(&expected);
+    free_writer(&loaded);
+    free_stream(&s);
+
+    // Anything that isn't a snapshot is refused.
+    rewind(f);
+    fputs("{\"not\": \"a snapshot\", \"but\": \"long enough\"}", f);
+    fflush(f);
+    assert(!load_snapshot(fileno(f), &t));
+    fclose(f);
+}
+
+// Parses input onto a tape, replaces word `index` with `word` unless index
+// is past the end, drops the last `words_cut` words and `strings_cut` bytes
+// of strings, and expects the saved snapshot to be refused.
+void test_bad_snapshot(char *input, size_t index, uint64_t word,
+                       size_t words_cut, size_t strings_cut) {
+    Stream s = create_static_stream(input);
+    Tape t = create_tape();
+    FILE *f = tmpfile();
+    Tape loaded;
+
+    assert(parse_tape(&s, &t) == PARSED);
+
+    if (index < t.words.size)
+        t.words.data[index] = word;
+
+    t.words.size -= words_cut;
+    t.strings.size -= strings_cut;
+    assert(write_snapshot(&t, f));
+    fflush(f);
+    assert(!load_snapshot(fileno(f), &loaded));
+
+    free_tape(&t);
+    free_stream(&s);
+    fclose(f);
+}
+
+void test_decode_string(char *input, char *expected) {
+    Stream s = create_static_stream(input);
+    Json j;
+
+    assert(parse_string(&s, &j) == PARSED);
+    assert(j.value.j_string.data >= s.data &&
+           j.value.j_string.data < s.data + s.size);
+
+    JsonString decoded = decode_json_string(j.value.j_string, &s.arena);
+    assert(json_string_equals(decoded, expected));
+
+    free_stream(&s);
+}
+
+void test_copied_string(char *input, char *expected) {
+    FILE *f = fmemopen(input, strlen(input), "r");
+    Stream s = create_chunked_stream(f, 2);
+    s.lookback = 0;
+    Json j;
+
+    assert(parse_json(&s, &j) == PARSED);
+
+    JsonString *key = &j.value.j_object.data[0].key;
+    assert(json_string_equals(*key, expected));
+    assert(key->data < s.data || key->data >= s.data + s.capacity);
+
+    free_stream(&s);
+    fclose(f);
+}
+
+// Counts events and stops after `limit` of them.
+typedef struct {
+    int events;
+    int limit;
+} EventCounter;
+
+int count_event(void *context) {
+    EventCounter *c = context;
+    return ++c->events != c->limit;
+}
+
+int count_key(void *c, JsonString *key) {
+    (void)key;
+    return count_event(c);
+}
+
+int count_number(void *c, JsonNumber *value) {
+    (void)value;
+    return count_event(c);
+}
+
+int count_boolean(void *c, int value) {
+    (void)value;
+    return count_event(c);
+}
+
+void test_events(char *input, int limit, int events, ParseResult result) {
+    Stream s = create_static_stream(input);
+    EventCounter c = {.limit = limit};
+    JsonHandler h = {.context = &c,
+                     .start_object = count_event,
+                     .end_object = count_event,
+                     .start_array = count_event,
+                     .end_array = count_event,
+                     .key = count_key,
+                     .string = count_key,
+                     .number = count_number,
+                     .boolean = count_boolean,
+                     .null = count_event};
+
+    assert(parse_events(&s, &h) == result);
+    assert(c.events == events);
+    assert(s.arena.scratch_size == 0);
+    free_stream(&s);
+}
+
+void test_writer(char *input, int indent, char *expected) {
+    Stream s = create_static_stream(input);
+    char *output;
+    size_t size;
+    FILE *f = open_memstream(&output, &size);
+    Writer w = create_writer(f, indent);
+    JsonHandler h = writer_handler(&w);
+
+    assert(parse_events(&s, &h) == PARSED);
+    free_writer(&w);
+    fclose(f);
+    assert(size == strlen(expected) && !memcmp(output, expected, size));
+
+    free(output);
+    free_stream(&s);
+}
+
+void test_writer_escaped(char *input, char *expected) {
+    char *output;
+    size_t size;
+    FILE *f = open_memstream(&output, &size);
+    Writer w = create_writer(f, 0);
+
+    writer_escaped(&w, input, strlen(input));
+    free_writer(&w);
+    fclose(f);
+    assert(size == strlen(expected) && !memcmp(output, expected, size));
+
+    free(output);
+}
+
+// Reads input in chunks of chunk_size if given. No threads parses it on the
+// calling thread.
+void test_ndjson(char *input, int threads, size_t chunk_size, char *expected,
+                 size_t failed) {
+    FILE *in = chunk_size ? fmemopen(input, strlen(input), "r") : NULL;
+    Stream s = chunk_size ? create_chunked_stream(in, chunk_size)
+                          : create_static_stream(input);
+    char *output;
+    size_t size;
+    FILE *f = open_memstream(&output, &size);
+    Writer w = create_writer(f, 0);
+
+    assert(parse_ndjson(&s, &w, threads, 0) == failed);
+    free_writer(&w);
+    fclose(f);
+
+    if (expected != NULL)
+        assert(size == strlen(expected) && !memcmp(output, expected, size));
+    else
+        assert(!memcmp(output, "1\nline 2:", 9));
+
+    free(output);
+    free_stream(&s);
+
+    if (in != NULL)
+        fclose(in);
+}
+
+// Selects path from input, read in chunks of chunk_size if given, and
+// compares the compact result with expected, or expects an error if NULL.
+void test_projection(char *input, char *path, size_t chunk_size,
+                     char *expected) {
+    FILE *f = fmemopen(input, strlen(input), "r");
+    Stream s = chunk_size ? create_chunked_stream(f, chunk_size)
+                          : create_static_stream(input);
+    Projection p = {0};
+    char *output;
+    size_t size;
+    FILE *out = open_memstream(&output, &size);
+    Writer w = create_writer(out, 0);
+    JsonHandler h = writer_handler(&w);
+    Json j;
+
+    assert(projection_add(&p, path));
+
+    if (expected == NULL) {
+        assert(parse_projected(&s, &p, &j) == ERROR);
+    } else {
+        assert(parse_projected(&s, &p, &j) == PARSED);
+        emit_json(&j, &h);
+    }
+
+    assert(s.arena.scratch_size == 0);
+    free_writer(&w);
+    fclose(out);
+
+    if (expected != NULL)
+        assert(size == strlen(expected) && !memcmp(output, expected, size));
+
+    free(output);
+    free_projection(&p);
+    free_stream(&s);
+    fclose(f);
+}
+
+// Feeds input to a push parser `piece` bytes at a time and compares the
+// compact output with expected, if the input is valid.
+void test_push(char *input, size_t piece, char *expected, ParseResult result,
+               size_t error) {
+    char *output;
+    size_t size;
+    FILE *f = open_memstream(&output, &size);
+    Writer w = create_writer(f, 0);
+    JsonHandler h = writer_handler(&w);
+    PushParser p = create_push_parser(&h);
+    size_t length = strlen(input);
+
+    for (size_t i = 0; i < length; i += piece)
+        push_parser_feed(&p, input + i, i + piece < length ? piece : length - i);
+
+    assert(push_parser_finish(&p) == result);
+    free_writer(&w);
+    fclose(f);
+
+    if (result == PARSED)
+        assert(size == strlen(expected) && !memcmp(output, expected, size));
+    else
+        assert(p.error == error);
+
+    free(output);
+    free_push_parser(&p);
+}
+
+// Nests `depth` arrays around a number, or objects if object is set, and
+// expects every parser to accept that exactly when it is within
+// json_max_depth, and to fail at the first bracket too deep otherwise.
+void test_depth(size_t depth, int object) {
+    char *open = object ? "{\"a\":" : "[";
+    size_t width = strlen(open);
+    size_t size = depth * (width + 1) + 1;
+    char *input = malloc(size + 1);
+    ParseResult result = depth <= json_max_depth ? PARSED : ERROR;
+    size_t error = json_max_depth * width;
+    JsonHandler none = {0};
+    Json j;
+
+    for (size_t i = 0; i < depth; i++) {
+        memcpy(input + i * width, open, width);
+        input[size - 1 - i] = object ? '}' : ']';
+    }
+    input[depth * width] = '0';
+    input[size] = '\0';
+
+    Stream s = create_static_stream(input);
+    assert(parse_json(&s, &j) == result);
+    assert(result == PARSED || s.current_position == error);
+    free_stream(&s);
+
+    s = create_static_stream(input);
+    assert(parse_events(&s, &none) == result);
+    free_stream(&s);
+
+    s = create_static_stream(input);
+    assert(parse_json_structural(&s, &j) == result);
+    assert(result == PARSED || s.current_position == error);
+    free_stream(&s);
+
+    s = create_static_stream(input);
+    Tape t = create_tape();
+    assert(parse_tape(&s, &t) == result);
+    free_tape(&t);
+    free_stream(&s);
+
+    PushParser p = create_push_parser(&none);
+    push_parser_feed(&p, input, size);
+    assert(push_parser_finish(&p) == result);
+    assert(result == PARSED || p.error == error);
+    free_push_parser(&p);
+
+    free(input);
+}
+
+// Writes j compactly and compares that with expected.
+void assert_emits(Json *j, char *expected) {
+    Writer w = create_writer(NULL, 0);
+    JsonHandler h = writer_handler(&w);
+
+    assert(emit_json(j, &h));
+    assert(w.size == strlen(expected) && !memcmp(w.data, expected, w.size));
+    free_writer(&w);
+}
+
+// Nests `depth` arrays around a number, or objects if object is set, and
+// has every engine that builds a tree, and every printer, go through it,
+// for depths past the default that --max-depth allows.
+void test_deep(size_t depth, int object) {
+    char *open = object ? "{\"a\":" : "[";
+    size_t width = strlen(open);
+    size_t size = depth * (width + 1) + 1;
+    char *input = malloc(size + 1);
+    Writer w = create_writer(NULL, 0);
+    JsonHandler h = writer_handler(&w);
+    Projection p = {0};
+    Json j;
+
+    for (size_t i = 0; i < depth; i++) {
+        memcpy(input + i * width, open, width);
+        input[size - 1 - i] = object ? '}' : ']';
+    }
+    input[depth * width] = '0';
+    input[size] = '\0';
+
+    Stream s = create_static_stream(input);
+    assert(parse_json(&s, &j) == PARSED);
+    assert_emits(&j, input);
+
+    Tape t = create_tape();
+    tape_append_json(&t, &j);
+    assert(emit_tape(&t, 0, &h));
+    assert(w.size == size && !memcmp(w.data, input, size));
+    writer_truncate(&w, 0);
+    free_tape(&t);
+    free_stream(&s);
+
+    s = create_static_stream(input);
+    assert(parse_json_structural(&s, &j) == PARSED);
+    assert_emits(&j, input);
+    free_stream(&s);
+
+    s = create_static_stream(input);
+    assert(parse_json_parallel_threads(&s, &j, 2, 0) == PARSED);
+    assert_emits(&j, input);
+    free_stream(&s);
+
+    s = create_static_stream(input);
+    t = create_tape();
+    assert(parse_tape(&s, &t) == PARSED);
+    assert(emit_tape(&t, 0, &h));
+    assert(w.size == size && !memcmp(w.data, input, size));
+    free_tape(&t);
+    free_stream(&s);
+
+    s = create_static_stream(input);
+    assert(projection_add(&p, object ? "$.a" : "$[0]"));
+    assert(parse_projected(&s, &p, &j) == PARSED);
+    assert_emits(&j, input);
+    free_projection(&p);
+    free_stream(&s);
+
+    if (!object) {
+        ArrayIterator it;
+
+        s = create_static_stream(input);
+        input[size - 1] = '\0';
+        assert(array_iterator_start(&it, &s, NULL) == PARSED);
+        assert(array_iterator_next(&it, &j) == PARSED);
+        assert_emits(&j, input + 1);
+        assert(array_iterator_next(&it, &j) == NOT_PARSED);
+        free_stream(&s);
+    }
+
+    free_writer(&w);
+    free(input);
+}
+
+// error is where every engine should find input invalid, or -1 if it is
+// valid.
+void test_checked_string(char *input, long error) {
+    size_t size = strlen(input);
+    ParseResult result = error < 0 ? PARSED : ERROR;
+    JsonHandler none = {0};
+    Json j;
+
+    Stream s = create_static_stream(input);
+    assert(parse_json(&s, &j) == result);
+    assert(result == PARSED || s.current_position == (size_t)error);
+    free_stream(&s);
+
+    FILE *f = fmemopen(input, size, "r");
+    s = create_chunked_stream(f, 1);
+    assert(parse_json(&s, &j) == result);
+    assert(result == PARSED || s.current_position == (size_t)error);
+    free_stream(&s);
+    fclose(f);
+
+    s = create_static_stream(input);
+    assert(parse_events(&s, &none) == result);
+    free_stream(&s);
+
+    s = create_static_stream(input);
+    assert(parse_json_structural(&s, &j) == result);
+    assert(result == PARSED || s.current_position == (size_t)error);
+    free_stream(&s);
+
+    s = create_static_stream(input);
+    Tape t = create_tape();
+    assert(parse_tape(&s, &t) == result);
+    free_tape(&t);
+    free_stream(&s);
+
+    PushParser p = create_push_parser(&none);
+    for (size_t i = 0; i < size; i++)
+        push_parser_feed(&p, input + i, 1);
+    assert(push_parser_finish(&p) == result);
+    assert(result == PARSED || p.error == (size_t)error);
+    free_push_parser(&p);
+}
+
+void test_schema(size_t chunk_size) {
+    char input[] = "[{\"_id\": \"a1\", \"index\": 0, \"isActive\": true, "
+                   "\"extra\": {\"x\": [1, {\"y\": \"]\"}]}, \"age\": 36, "
+                   "\"tags\": [\"one\", \"two\"], \"friends\": [{\"id\": 7, "
+                   "\"name\": \"Elva\"}], \"company\": null},\n"
+                   " {\"name\": \"B\\u00e9ard\", \"tags\": [], "
+                   "\"isActive\": false,}]";
+    FILE *f = fmemopen(input, strlen(input), "r");
+    Stream s = chunk_size ? create_chunked_stream(f, chunk_size)
+                          : create_static_stream(input);
+    Schema_Person_ARRAY people;
+
+    assert(parse_schema_Person_ARRAY(&s, &people) == PARSED);
+    assert(people.size == 2);
+
+    Schema_Person *p = &people.data[0];
+    assert(json_string_equals(p->_id, "a1") && p->index == 0 && p->isActive);
+    assert(p->age == 36 && p->company.data == NULL);
+    assert(p->tags.size == 2 && json_string_equals(p->tags.data[1], "two"));
+    assert(p->friends.size == 1 && p->friends.data[0].id == 7);
+    assert(json_string_equals(p->friends.data[0].name, "Elva"));
+
+    p = &people.data[1];
+    assert(json_string_equals(decode_json_string(p->name, &s.arena),
+                              "B\xc3\xa9" "ard"));
+    assert(p->tags.size == 0 && !p->isActive && p->friends.data == NULL);
+    assert(s.arena.scratch_size == 0);
+
+    free_stream(&s);
+    fclose(f);
+}
+
+void test_schema_error(char *input, size_t error) {
+    Stream s = create_static_stream(input);
+    Schema_Person person;
+
+    assert(parse_schema_Person(&s, &person) == ERROR);
+    assert(s.current_position == error);
+    free_stream(&s);
+}
+
+// Items of the array at path in input, compared with the compact form of
+// each, one per line in expected. error is where iteration should fail, or
+// -1 if it shouldn't.
+void test_iterator(char *input, char *path, char *expected, long error) {
+    FILE *f = fmemopen(input, strlen(input), "r");
+    Stream s = create_chunked_stream(f, 3);
+    Writer w = create_writer(NULL, 0);
+    JsonHandler h = writer_handler(&w);
+    ArrayIterator it;
+    ParseResult result;
+    Json j;
+
+    s.lookback = 0;
+    result = array_iterator_start(&it, &s, path);
+
+    while (result == PARSED &&
+           (result = array_iterator_next(&it, &j)) == PARSED) {
+        emit_json(&j, &h);
+        writer_byte(&w, '\n');
+        assert(s.capacity < 64);
+    }
+
+    assert(result == (error < 0 ? NOT_PARSED : ERROR));
+    assert(error < 0 || s.current_position == (size_t)error);
+    assert(w.size == strlen(expected) && !memcmp(w.data, expected, w.size));
+
+    free_writer(&w);
+    free_stream(&s);
+    fclose(f);
+}
+
+void test_list() {
+    List_char l = create_list_char(0);
+    assert(l.data == NULL && l.capacity == 0);
+
+    for (int i = 0; i < 100; i++)
+        append_list_char(&l, 'a' + i % 26);
+    assert(l.size == 100 && l.capacity >= 100);
+
+    reserve_list_char(&l, 1000);
+    assert(l.capacity >= 1100 && l.size == 100 && l.data[99] == 'a' + 99 % 26);
+
+    shrink_list_char(&l);
+    assert(l.capacity == 100 && l.data[0] == 'a');
+
+    l.size = 0;
+    shrink_list_char(&l);
+    assert(l.data == NULL && l.capacity == 0);
+    free_list_char(&l);
+}
+
+void test_format_integer(int64_t value, char *expected) {
+    char formatted[32];
+    int length = format_int64(value, formatted);
+
+    assert(length == (int)strlen(expected));
+    assert(!memcmp(formatted, expected, length));
+}
+
+int run_tests() {
+    test_null("null", PARSED);
+    test_null("nul", NOT_PARSED);
+    test_null("", NOT_PARSED);
+
+    test_true("true", PARSED);
+    test_true("truue", NOT_PARSED);
+    test_true("", NOT_PARSED);
+
+    test_false("false", PARSED);
+    test_false("falze", NOT_PARSED);
+    test_false("", NOT_PARSED);
+
+    test_number("1", 1, PARSED);
+    test_number("2", 2, PARSED);
+    test_number("0", 0, PARSED);
+    test_number("-", 0, ERROR);
+    test_number("", -1, NOT_PARSED);
+    test_number("-1", -1, PARSED);
+    test_number("-1235235", -1235235, PARSED);
+    test_number("9223372036854775807", 9223372036854775807, PARSED);
+    test_number("-9223372036854775808", INT64_MIN, PARSED);
+    test_number("1.", 0, ERROR);
+    test_number("1e+", 0, ERROR);
+    test_number("-.5", 0, ERROR);
+
+    test_double("0.5", 0.5);
+    test_double("-1.25e-3", -1.25e-3);
+    test_double("1E10", 1e10);
+    test_double("-9223372036854775809", -9223372036854775809.0);
+    test_double("2.2250738585072011e-308", 2.2250738585072011e-308);
+    test_double("1.7976931348623157e308", 1.7976931348623157e308);
+    test_double("123456789012345678901234567890", 1.2345678901234568e29);
+    test_double("0.1000000000000000055511151231257827021181583404541015625",
+                0.1);
+    test_json("1e400", ERROR);
+    test_long_integer(400, 0);
+    test_long_integer(400, 1);
+    test_json("01", PARSED);
+    test_json("[01]", ERROR);
+    test_unsigned("9223372036854775808", 9223372036854775808ULL);
+    test_unsigned("18446744073709551615", 18446744073709551615ULL);
+    test_double("18446744073709551616", 18446744073709551616.0);
+    test_format_double(0.0, "0");
+    test_format_double(-0.0, "-0");
+    test_format_double(0.1, "0.1");
+    test_format_double(-1.25e-3, "-0.00125");
+    test_format_double(1e-5, "1e-05");
+    test_format_double(1e15, "1e+15");
+    test_format_double(123456789012345.0, "123456789012345");
+    test_format_double(1234567890123456.0, "1234567890123456");
+    test_format_double(18446744073709551616.0, "1.8446744073709552e+19");
+    test_format_double(5e-324, "5e-324");
+    test_format_double(2.2250738585072014e-308, "2.2250738585072014e-308");
+    test_format_double(1.7976931348623157e308, "1.7976931348623157e+308");
+    test_format_double_round_trip();
+
+    test_string("\"h ahahaah\"", PARSED);
+    test_string("", NOT_PARSED);
+    test_string("\"ahhahaha", ERROR);
+    test_string("\"escaped \\\" quote\"", PARSED);
+    test_string("\"trailing \\", ERROR);
+    test_string("\"bad \\x escape\"", ERROR);
+    test_string("\"short \\u12\"", ERROR);
+
+    test_checked_string("[\"plain\"]", -1);
+    test_checked_string("[\"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u00e9\"]", -1);
+    test_checked_string("[\"\\ud83d\\ude00\"]", -1);
+    test_checked_string("[\"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80\"]", -1);
+    test_checked_string("[\"raw\ttab\"]", -1);
+    test_checked_string("[\"ab\\q\"]", 4);
+    test_checked_string("[\"\\u12g4\"]", 2);
+    test_checked_string("[\"\\ud83d\"]", 2);
+    test_checked_string("[\"\\ud83dx\\ude00\"]", 2);
+    test_checked_string("[\"\\ude00\"]", 2);
+    // Truncated, overlong, a surrogate, past U+10FFFF and a stray
+    // continuation byte.
+    test_checked_string("[\"ab\xc3\"]", 4);
+    test_checked_string("[\"ab\xc0\xaf\"]", 4);
+    test_checked_string("[\"ab\xe0\x80\xaf\"]", 4);
+    test_checked_string("[\"ab\xed\xa0\x80\"]", 4);
+    test_checked_string("[\"ab\xf4\x90\x80\x80\"]", 4);
+    test_checked_string("[\"\xc3\xa9\x80\"]", 4);
+    test_checked_string("{\"k\xff\": 1}", 3);
+
+    test_array("[],", PARSED);
+    test_array("[", ERROR);
+    test_array("]", NOT_PARSED);
+    test_array("[1,2]", PARSED);
+    test_array("[1,true,2]", PARSED);
+    test_array("[1,true,2   ]", PARSED);
+    test_array("[\t\n\t\n\n   ]", PARSED);
+    test_array("[\t\n\t\n\ntrue,\n\"ahahha\",false,   ]", PARSED);
+    test_array("[1,true,2, null, true, [], [[], [[]]]]", PARSED);
+    test_array("[1,true,2, null, true, [, [[], [[]]]]", ERROR);
+    test_array("", NOT_PARSED);
+
+    test_object("{}", PARSED);
+    test_object("{", ERROR);
+    test_object("}", NOT_PARSED);
+    test_object("{\"key\":1}", PARSED);
+    test_object("{\"key\":1, \"name\":   \"adrian\", \"arr\": [1,2]}", PARSED);
+    test_object("{\"key\":1, \"name:   \"adrian\", \"arr\": [1,2]}", ERROR);
+
+    test_json("", ERROR);
+    test_json("1", PARSED);
+    test_json("true", PARSED);
+    test_json("false", PARSED);
+    test_json("null", PARSED);
+    test_json("[]", PARSED);
+    test_json("{}", PARSED);
+    test_json("\"asfsadf\"", PARSED);
+    test_json("{\"test\":   [2s]}", ERROR);
+    test_json("{\"test\":   [2]}", PARSED);
+    test_json("{\"test\": {\n\t}}", PARSED);
+    test_json("[{\"test\":[\n\n\t\"ahah\",\n\t\r\"test\",2]}]", PARSED);
+    test_json("   ", ERROR);
+    test_json("nul", ERROR);
+    test_json("falsy", ERROR);
+    test_json("  -12", PARSED);
+    test_json("+1", ERROR);
+    test_json("[true, fals]", ERROR);
+    test_json("{\"a\": {\"b\": [null, false, true, \"c\"]}}", PARSED);
+
+    test_chunked_stream("[1, true, null, \"abc\"]", 1, PARSED);
+    test_chunked_stream("{\"a\": [1, 2, 3], \"b\": {\"c\": false}}", 3, PARSED);
+    test_chunked_stream("[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, "
+                        "17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28]",
+                        4, PARSED);
+    test_chunked_stream("[1, 2,, 3]", 2, ERROR);
+
+    test_mapped_stream("{\"a\": [1, 2, 3], \"b\": {\"c\": false}}", PARSED);
+    test_mapped_stream("{\"a\": [1, 2, 3], \"b\": {\"c\" false}}", ERROR);
+
+    test_structural("", ERROR);
+    test_structural("1", PARSED);
+    test_structural("  -42  ", PARSED);
+    test_structural("null", PARSED);
+    test_structural("\"a \\\"quoted\\\" [string], {with: structurals}\"", PARSED);
+    test_structural("[1,true,2, null, true, [], [[], [[]]]]", PARSED);
+    test_structural("{\"key\":1, \"name\":   \"adrian\", \"arr\": [1,2]}", PARSED);
+    test_structural("[{\"test\":[\n\n\t\"ahah\",\n\t\r\"test\",2]}]", PARSED);
+    test_structural("{\"a\\\\\": \"b\\\\\", \"c\": [\"\\\\\\\"\"]}", PARSED);
+    test_structural("[\"a string that is long enough to cross the 64 byte "
+                    "block boundary\", 1234567, \"x\"]",
+                    PARSED);
+    test_structural("[1,]", PARSED);
+    test_structural("[\"a\",\n]", PARSED);
+    test_structural("[\t\n\t\n\ntrue,\n\"ahahha\",false,   ]", PARSED);
+    test_structural("{\"a\":1,}", PARSED);
+    test_structural("[{\"a\": [1, 2,], \"b\": {},},]", PARSED);
+    test_structural("[,]", ERROR);
+    test_structural("{,}", ERROR);
+    test_structural("[1,,]", ERROR);
+    test_structural("[1, 2,, 3]", ERROR);
+    test_structural("{\"test\":   [2s]}", ERROR);
+    test_structural("[1 2]", ERROR);
+    test_structural("[truefalse]", ERROR);
+    test_structural("{\"a\" 1}", ERROR);
+    test_structural("[\"open", ERROR);
+    test_structural_error("[1, 2,, 3]", 6);
+    test_structural_error("{\"test\":   [2s]}", 13);
+    test_structural_error("[1, \"open", 4);
+    test_structural_error("[1, 2", 5);
+
+    test_decode_string("\"plain\"", "plain");
+    test_decode_string("\"a\\\"b\\\\c\\/d\"", "a\"b\\c/d");
+    test_decode_string("\"\\b\\f\\n\\r\\t\"", "\b\f\n\r\t");
+    test_decode_string("\"\\u0041\\u00e9\\u20AC\"", "A\xc3\xa9\xe2\x82\xac");
+    test_decode_string("\"\\ud83d\\ude00\"", "\xf0\x9f\x98\x80");
+    test_copied_string("{\"a key that spans chunks\": 1}", "a key that spans chunks");
+    test_copied_string("{\"esc\\\"aped\": 1}", "esc\\\"aped");
+
+    test_tape();
+    test_snapshot("{\"name\": \"adrian\", \"tags\": [1, -2, 1.5, "
+                  "18446744073709551615, true, false, null, [], {}], "
+                  "\"esc\\\"aped\": \"a\\nb\"}");
+    test_snapshot("\"\"");
+    // A container that ends past the tape, or short of its end word.
+    test_bad_snapshot("[1, 2]", 0, (uint64_t)'[' << 56 | 99, 0, 0);
+    test_bad_snapshot("[1, [2]]", 0, (uint64_t)'[' << 56 | 4, 0, 0);
+    test_bad_snapshot("[1, [2]]", 3, (uint64_t)'[' << 56 | 8, 0, 0);
+    // End words that don't match their start.
+    test_bad_snapshot("[[], []]", 2, (uint64_t)']' << 56 | 3, 0, 0);
+    test_bad_snapshot("{\"a\": []}", 3, (uint64_t)'}' << 56 | 3, 0, 0);
+    // Strings outside the buffer, or longer than it.
+    test_bad_snapshot("[\"abc\"]", 1, (uint64_t)'"' << 56 | 1000, 0, 0);
+    test_bad_snapshot("[\"abc\"]", 1, (uint64_t)'"' << 56 | 6, 0, 0);
+    test_bad_snapshot("\"abc\"", SIZE_MAX, 0, 0, 1);
+    // A number without its value word.
+    test_bad_snapshot("12", SIZE_MAX, 0, 1, 0);
+    // Keys that aren't strings, and unknown types.
+    test_bad_snapshot("{\"a\": 1}", 1, (uint64_t)'t' << 56, 0, 0);
+    test_bad_snapshot("[true]", 1, (uint64_t)'x' << 56, 0, 0);
+
+    test_interned_keys(parse_json, 0);
+    test_interned_keys(parse_json, 3);
+    test_interned_keys(parse_json_structural, 5);
+    test_object_get(1);
+    test_object_get(7);
+    test_object_get(100);
+    test_object_get(5000);
+
+    test_parallel("{\"a\": \"],\\\"[\", \"b\": [1, {\"c\": \"\\\\\"}]}", 3, 0,
+                  0);
+    test_parallel("\"\\\\\\\"x,\"", 4, 0, 0);
+    test_parallel("[[1, 2], {}]", 2, 2345, 0);
+    test_parallel("[[1, 2], {}]", 3, 0, 1);
+    test_parallel("{\"a\": [1,]}", 4, 0, 1);
+    json_max_depth = 3;
+    test_parallel_depth(2);
+    test_parallel_depth(3);
+    json_max_depth = JSON_MAX_DEPTH;
+
+    char *doc = "{\"a\": [1, \"b\", true, null], \"c\": {}}";
+    test_events(doc, 0, 12, PARSED);
+    test_events(doc, 4, 4, ABORTED);
+    test_events("[1, 2", 0, 3, ERROR);
+    test_events("[1, {\"a\": 2}]", 0, 7, PARSED);
+    test_events("{\"a\": [1, 2], \"b\": {}}", 6, 6, ABORTED);
+    test_events("  ", 0, 0, ERROR);
+
+    test_writer(" [1, {\"a\" : [] }, {}, \"x\\\"\"] ", 0,
+                "[1,{\"a\":[]},{},\"x\\\"\"]");
+    test_writer("{\"a\": [true, null], \"b\": -1.5}", 2,
+                "{\n  \"a\": [\n    true,\n    null\n  ],\n  \"b\": -1.5\n}");
+    test_writer("\"tab\there\"", 0, "\"tab\\u0009here\"");
+    test_writer("18446744073709551615", 4, "18446744073709551615");
+    test_writer_escaped("a\"b\\c\nd\x01", "\"a\\\"b\\\\c\\nd\\u0001\"");
+    for (size_t chunk_size = 0; chunk_size <= 4; chunk_size += 2) {
+        for (int threads = 0; threads <= 3; threads += 3) {
+            test_ndjson("{\"a\": 1}\n\n [2, 3] \r\n\"x\"", threads,
+                        chunk_size, "{\"a\":1}\n[2,3]\n\"x\"\n", 0);
+            test_ndjson("1\n{\"a\" 1}\n2\n", threads, chunk_size, NULL, 1);
+        }
+    }
+    test_ndjson("", 2, 0, "", 0);
+    char *users = "[{\"id\": 1, \"email\": \"a@x\", \"tags\": [\"]\", \"{\"]},"
+                  " {\"id\": 2, \"skip\": {\"email\": [[{}]]}},"
+                  " {\"email\": {\"work\": \"c\\\"@x\"}, \"a/b\": true}, 7]";
+    test_projection(users, "$[*].email", 0,
+                    "[{\"email\":\"a@x\"},"
+                    "{\"email\":{\"work\":\"c\\\"@x\"}}]");
+    test_projection(users, "$[*].email", 3,
+                    "[{\"email\":\"a@x\"},"
+                    "{\"email\":{\"work\":\"c\\\"@x\"}}]");
+    test_projection(users, "$[0].tags[1]", 0, "[{\"tags\":[\"{\"]}]");
+    test_projection(users, "/2/a~1b", 2, "[{\"a/b\":true}]");
+    test_projection(users, "/3", 0, "[7]");
+    test_projection("[1, {\"a\": 2}]", "$", 0, "[1,{\"a\":2}]");
+    test_projection("[{\"b\": 1}, 2, {\"a\": 3}]", "$[*].a", 0,
+                    "[{\"a\":3}]");
+    test_projection("[[], {}, [{\"b\": []}]]", "$[*][*].b", 0,
+                    "[[{\"b\":[]}]]");
+    test_projection("{\"a\": {\"b\": 1}}", "$.a.c", 0, "null");
+    test_projection("{\"a\": \"open, \"b\": 3}", "/b", 0, NULL);
+    test_projection("[1, [2, 3], tru]", "/0", 0, NULL);
+    char *pushed = " {\"a\": [1, -2.5e3, \"x\\\"y\"], \"b\": {\"c\": null},"
+                   " \"d\": [true, false, [], {}], \"e\": 12345678901234} ";
+    char *compact = "{\"a\":[1,-2500,\"x\\\"y\"],\"b\":{\"c\":null},"
+                    "\"d\":[true,false,[],{}],\"e\":12345678901234}";
+    for (size_t piece = 1; piece <= 8; piece++)
+        test_push(pushed, piece, compact, PARSED, 0);
+    test_push(pushed, 1000, compact, PARSED, 0);
+    test_push("12", 1, "12", PARSED, 0);
+    test_push("[1,]", 1, "[1]", PARSED, 0);
+    test_push("[1, tru", 2, NULL, ERROR, 7);
+    test_push("[1 2]", 1, NULL, ERROR, 3);
+    test_push("[truex]", 3, NULL, ERROR, 5);
+    test_push("{\"a\" 1}", 2, NULL, ERROR, 5);
+    test_push("[1.e5]", 1, NULL, ERROR, 3);
+    test_push("1 2", 1, NULL, ERROR, 2);
+    test_push("", 1, NULL, ERROR, 0);
+    test_depth(1, 0);
+    test_depth(JSON_MAX_DEPTH, 0);
+    test_depth(JSON_MAX_DEPTH + 1, 0);
+    test_depth(JSON_MAX_DEPTH, 1);
+    test_depth(JSON_MAX_DEPTH + 1, 1);
+    json_max_depth = 3;
+    test_depth(3, 1);
+    test_depth(4, 0);
+    json_max_depth = JSON_MAX_DEPTH_LIMIT;
+    test_deep(2 * JSON_MAX_DEPTH, 0);
+    test_deep(2 * JSON_MAX_DEPTH, 1);
+    json_max_depth = JSON_MAX_DEPTH;
+    test_format_integer(0, "0");
+    test_format_integer(7, "7");
+    test_format_integer(-10, "-10");
+    test_format_integer(1234567, "1234567");
+    test_format_integer(INT64_MIN, "-9223372036854775808");
+    test_arena();
+    test_simd_kernels();
+    test_list();
+
+    test_schema(0);
+    test_schema(1);
+    test_schema(7);
+    test_schema_error("{\"age\": \"36\"}", 8);
+    test_schema_error("{\"age\": 3.5}", 8);
+    test_schema_error("{\"tags\": [\"a\", 1]}", 15);
+    test_schema_error("{\"friends\": [{\"id\": 1 \"name\": 2}]}", 22);
+    test_schema_error("{\"other\": [}", 12);
+
+    test_iterator(" [1, {\"a\": [true]}, \"s\" ] ", NULL,
+                  "1\n{\"a\":[true]}\n\"s\"\n", -1);
+    test_iterator("[]", "", "", -1);
+    test_iterator("[1,]", "", "1\n", -1);
+    test_iterator("{\"skip\": [[1], {\"x\": \"]\"}], \"data\": [[2], 3]}",
+                  "$.data", "[2]\n3\n", -1);
+    test_iterator("{\"a\": [0, {\"b\": [4, 5]}]}", "/a/1/b", "4\n5\n", -1);
+    test_iterator("{\"a\": [0, {\"b\": [4, 5]}]}", "$.a[1].b", "4\n5\n", -1);
+    test_iterator("{\"a\": 1}", "$.b", "", 7);
+    test_iterator("{\"a\": 1}", "$.a", "", 6);
+    test_iterator("[1, 2 3]", "", "1\n2\n", 6);
+    test_iterator("[1, nul]", "", "1\n", 4);
+
+    return 1;
+}
+
+// bench.c includes this file for everything but main.
+#ifndef JSON_NO_MAIN
+int main(int argc, char **argv) {
+    init_simd();
+    assert(run_tests());
+    STATS_RESET();
+
+    char *path = NULL;
+    JsonParser parse = parse_json;
+    int tape = 0;
+    int validate = 0;
+    int stream = 0;
+    int indent = -1;
+    int ndjson = 0;
+    int push = 0;
+    int snapshot = 0;
+    char *save = NULL;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    Projection projection = {0};
+    char *each = NULL;
+    int stats = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--engine=structural"))
+            parse = parse_json_structural;
+        else if (!strcmp(argv[i], "--engine=recursive"))
+            parse = parse_json;
+        else if (!strcmp(argv[i], "--engine=parallel"))
+            parse = parse_json_parallel;
+        else if (!strcmp(argv[i], "--tape"))
+            tape = 1;
+        else if (!strcmp(argv[i], "--validate"))
+            validate = 1;
+        else if (!strcmp(argv[i], "--stream"))
+            stream = 1;
+        else if (!strcmp(argv[i], "--compact"))
+            indent = 0;
+        else if (!strncmp(argv[i], "--indent=", 9))
+            indent = atoi(argv[i] + 9);
+        else if (!strcmp(argv[i], "--ndjson"))
+            ndjson = 1;
+        else if (!strcmp(argv[i], "--push"))
+            push = 1;
+        else if (!strncmp(argv[i], "--max-depth=", 12)) {
+            char *value = argv[i] + 12;
+            char *end;
+
+            json_max_depth = strtoull(value, &end, 10);
+
+            // strtoull also takes signs and leading spaces.
+            if (!char_is_digit(*value) || *end != '\0' ||
+                json_max_depth < 1 || json_max_depth > JSON_MAX_DEPTH_LIMIT) {
+                printf("--max-depth must be from 1 to %d\n",
+                       JSON_MAX_DEPTH_LIMIT);
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--snapshot"))
+            snapshot = 1;
+        else if (!strncmp(argv[i], "--save-snapshot=", 16))
+            save = argv[i] + 16;
+        else if (!strncmp(argv[i], "--threads=", 10))
+            threads = atoi(argv[i] + 10);
+        else if (!strcmp(argv[i], "--stats"))
+            stats = 0;
+        else if (!strcmp(argv[i], "--stats=json"))
+            stats = 1;
+        else if (!strcmp(argv[i], "--each"))
+            each = "";
+        else if (!strncmp(argv[i], "--each=", 7))
+            each = argv[i] + 7;
+        else if (!strncmp(argv[i], "--select=", 9)) {
+            if (!projection_add(&projection, argv[i] + 9)) {
+                printf("Bad path '%s'\n", argv[i] + 9);
+                return -1;
+            }
+        } else
+            path = argv[i];
+    }
+
+    if (path == NULL) {
+        printf("Gimmi some json");
+        return -1;
+    }
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        printf("File '%s' not found\n", path);
+        return -1;
+    }
+
+    // One document per line reads best compact, a single one indented.
+    if (indent < 0)
+        indent = ndjson || each != NULL ? 0 : 2;
+
+    if (threads < 1)
+        threads = 1;
+
+    parallel_threads = threads;
+
+    Tape loaded;
+
+    if (snapshot && !load_snapshot(fileno(f), &loaded)) {
+        printf("'%s' is not a snapshot\n", path);
+        return -1;
+    }
+
+    // The push parser and snapshots read the file themselves. --each reads
+    // in chunks even from a regular file, so that memory stays bounded.
+    Stream s = push || snapshot ? (Stream){0}
+               : each != NULL   ? create_chunked_stream(f, STREAM_CHUNK_SIZE)
+                                : create_file_stream(f);
+    Writer w = create_writer(stdout, indent);
+    JsonHandler out = validate ? (JsonHandler){0} : writer_handler(&w);
+    ParseResult result;
+
+    if (ndjson) {
+        parse_ndjson(&s, &w, threads, validate);
+        result = PARSED;
+    } else if (snapshot) {
+        emit_tape(&loaded, 0, &out);
+        free_tape(&loaded);
+        result = PARSED;
+    } else if (push) {
+        result = parse_pushed(fileno(f), &out, &s);
+    } else if (each != NULL) {
+        // One item per line, each released before the next is parsed.
+        ArrayIterator it;
+        Json j;
+
+        result = array_iterator_start(&it, &s, each);
+
+        while (result == PARSED &&
+               (result = array_iterator_next(&it, &j)) == PARSED) {
+            emit_json(&j, &out);
+
+            if (!validate)
+                writer_byte(&w, '\n');
+        }
+
+        if (result == NOT_PARSED)
+            result = PARSED;
+    } else if (projection.count > 0) {
+        Json j;
+
+        if ((result = parse_projected(&s, &projection, &j)) == PARSED)
+            emit_json(&j, &out);
+    } else if (tape) {
+        Tape t = create_tape();
+
+        if ((result = parse_tape(&s, &t)) == PARSED) {
+            if (save != NULL && !save_snapshot(&t, save))
+                fprintf(stderr, "Couldn't write '%s'\n", save);
+
+            emit_tape(&t, 0, &out);
+        }
+
+        free_tape(&t);
+    } else if (validate || stream) {
+        // No tree is built; --stream writes values as they are parsed, so
+        // an error shows up after whatever came before it.
+        result = parse_events(&s, &out);
+    } else {
+        Json j;
+
+        if ((result = parse(&s, &j)) == PARSED) {
+            if (save != NULL) {
+                Tape t = create_tape();
+
+                tape_append_json(&t, &j);
+                if (!save_snapshot(&t, save))
+                    fprintf(stderr, "Couldn't write '%s'\n", save);
+
+                free_tape(&t);
+            }
+
+            emit_json(&j, &out);
+        }
+    }
+
+    if (result == PARSED && !validate && !ndjson && each == NULL)
+        writer_byte(&w, '\n');
+
+    if (result != PARSED) {
+        writer_flush(&w);
+        display_error(&s);
+    }
+
+    free_writer(&w);
+
+    if (stats >= 0)
+        print_stats(stderr, s.size, stats);
+
+    free_projection(&projection);
+    free_stream(&s);
+    fclose(f);
+    return 0;
+}
+#endif
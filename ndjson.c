@@ -0,0 +1,417 @@
+// NDJSON
+//
+// Every line of the input is a document of its own. A reader thread cuts the
+// input into batches of whole lines as it arrives, and a pool of threads
+// parse them in whatever order they pick them up, each thread with its own
+// arena. A batch keeps its output in memory until every batch before it has
+// been written, so documents and error reports come out in input order. The
+// reader stays at most a few batches per thread ahead of the output, so
+// memory is bounded by those batches rather than the input, and output is
+// flushed whenever the writer waits, so lines piped in slowly come out as
+// they are parsed.
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define NDJSON_BATCH_SIZE (1 << 20)
+#define NDJSON_BATCHES_AHEAD 4
+
+// An error report in a batch's output. The absolute line number is only
+// known once the batches before it are counted, so it is written then.
+typedef struct {
+    size_t at;
+    size_t line;
+} NdjsonError;
+
+LIST(NdjsonError);
+CREATE_LIST(NdjsonError);
+APPEND_LIST(NdjsonError);
+FREE_LIST(NdjsonError);
+
+// Batches of a chunked stream own their input; those of a stream that is
+// all in memory point into it.
+typedef struct {
+    char *input;
+    size_t size;
+    int owned;
+    size_t lines;
+    Writer output;
+    List_NdjsonError errors;
+    int done;
+} NdjsonBatch;
+
+// Batch i is in slot i % window until it has been written. pending holds
+// what a chunked stream has read past the last batch, at_end is set once it
+// is read to the end, and finished once the last batch is handed out.
+typedef struct {
+    Stream *stream;
+    List_char pending;
+    int at_end;
+    int indent;
+    int validate;
+    NdjsonBatch *batches;
+    size_t window;
+    size_t count;
+    size_t next;
+    size_t written;
+    int finished;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} NdjsonJob;
+
+// Lines only reference the input, so the stream is a view of it sharing the
+// worker's arena and is never freed itself.
+ParseResult parse_ndjson_line(Stream *s, JsonHandler *h) {
+    ParseResult result = parse_events(s, h);
+
+    if (result != PARSED)
+        return result;
+
+    eat_whitespace(s);
+    return s->current_position == s->size ? PARSED : ERROR;
+}
+
+void parse_ndjson_batch(NdjsonJob *job, NdjsonBatch *b, Arena *arena) {
+    Writer *w = &b->output;
+    JsonHandler h = job->validate ? (JsonHandler){0} : writer_handler(w);
+
+    *w = create_writer(NULL, job->indent);
+    b->errors = create_list_NdjsonError(0);
+
+    for (size_t start = 0; start < b->size; b->lines++) {
+        char *line = b->input + start;
+        char *newline = memchr(line, '\n', b->size - start);
+        size_t end = newline != NULL ? (size_t)(newline - b->input) : b->size;
+        Stream s = {.data = line,
+                    .current_position = start,
+                    .size = end,
+                    .offset = start,
+                    .capacity = end - start,
+                    .arena = *arena};
+        size_t mark = w->size;
+
+        eat_whitespace(&s);
+
+        if (s.current_position < s.size) {
+            if (parse_ndjson_line(&s, &h) == PARSED) {
+                if (!job->validate)
+                    writer_byte(w, '\n');
+            } else {
+                char *report;
+                size_t size;
+                FILE *f = open_memstream(&report, &size);
+
+                display_error_to(f, &s);
+                fclose(f);
+
+                writer_truncate(w, mark);
+                append_list_NdjsonError(
+                    &b->errors, (NdjsonError){.at = mark, .line = b->lines});
+                writer_write(w, report, size);
+                free(report);
+            }
+        }
+
+        *arena = s.arena;
+        reset_arena(arena);
+        start = end + 1;
+    }
+}
+
+// Reads whatever is available, up to size bytes. Files are read through
+// their descriptor, as a pipe's fread would wait for all of size; streams
+// without one, like fmemopen's, through stdio. Returns 0 at the end of the
+// input or on an error.
+size_t ndjson_read(FILE *f, char *data, size_t size) {
+    int fd = fileno(f);
+    ssize_t n;
+
+    if (fd < 0)
+        return fread(data, sizeof(char), size, f);
+
+    while ((n = read(fd, data, size)) < 0 && errno == EINTR)
+        ;
+
+    return n > 0 ? n : 0;
+}
+
+// Just past the last newline in data[from, to), or 0 if there is none.
+size_t ndjson_lines_end(char *data, size_t from, size_t to) {
+    for (size_t i = to; i > from; i--) {
+        if (data[i - 1] == '\n')
+            return i;
+    }
+
+    return 0;
+}
+
+// Cuts the next batch off the input. A batch ends after a newline, or at
+// the end of the input. From a chunked stream, it is cut once it reaches
+// NDJSON_BATCH_SIZE or a read comes up short, so that a slow writer's lines
+// aren't held back. Returns 0 when there is nothing left.
+int ndjson_read_batch(NdjsonJob *job, NdjsonBatch *b) {
+    Stream *s = job->stream;
+    List_char *pending = &job->pending;
+
+    *b = (NdjsonBatch){0};
+
+    if (s->source == NULL) {
+        char *input = s->data + (s->current_position - s->offset);
+        size_t size = s->size - s->current_position;
+
+        if (size == 0)
+            return 0;
+
+        size_t end = size > NDJSON_BATCH_SIZE ? NDJSON_BATCH_SIZE : size;
+        char *newline = memchr(input + end - 1, '\n', size - end + 1);
+
+        b->input = input;
+        b->size = newline != NULL ? (size_t)(newline - input) + 1 : size;
+        s->current_position += b->size;
+        return 1;
+    }
+
+    size_t cut = ndjson_lines_end(pending->data, 0, pending->size);
+
+    while (!job->at_end && (cut == 0 || pending->size < NDJSON_BATCH_SIZE)) {
+        reserve_list_char(pending, s->chunk_size);
+
+        size_t read_amount = ndjson_read(
+            s->source, pending->data + pending->size, s->chunk_size);
+        STATS_ADD(refills, 1);
+        STATS_ADD(refill_bytes, read_amount);
+
+        if (read_amount == 0) {
+            job->at_end = 1;
+            break;
+        }
+
+        size_t end = ndjson_lines_end(pending->data, pending->size,
+                                      pending->size + read_amount);
+        pending->size += read_amount;
+
+        if (end > 0)
+            cut = end;
+
+        if (cut > 0 && read_amount < s->chunk_size)
+            break;
+    }
+
+    if (job->at_end)
+        cut = pending->size;
+
+    if (cut == 0)
+        return 0;
+
+    // The batch takes the buffer, and the start of a line after the cut
+    // moves to a new one.
+    List_char rest = create_list_char(0);
+
+    if (cut < pending->size) {
+        reserve_list_char(&rest, pending->size - cut);
+        memcpy(rest.data, pending->data + cut, pending->size - cut);
+        rest.size = pending->size - cut;
+    }
+
+    *b = (NdjsonBatch){.input = pending->data, .size = cut, .owned = 1};
+    *pending = rest;
+    return 1;
+}
+
+void *ndjson_worker(void *context) {
+    NdjsonJob *job = context;
+    Arena arena = create_arena();
+
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+
+        while (job->next == job->count && !job->finished)
+            pthread_cond_wait(&job->changed, &job->lock);
+
+        if (job->next == job->count) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+
+        NdjsonBatch *b = &job->batches[job->next++ % job->window];
+        pthread_mutex_unlock(&job->lock);
+
+        parse_ndjson_batch(job, b, &arena);
+
+        pthread_mutex_lock(&job->lock);
+        b->done = 1;
+        pthread_cond_broadcast(&job->changed);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    free_arena(&arena);
+    STATS_MERGE();
+    return NULL;
+}
+
+void *ndjson_reader(void *context) {
+    NdjsonJob *job = context;
+    NdjsonBatch b;
+    int more = 1;
+
+    while (more) {
+        pthread_mutex_lock(&job->lock);
+        while (job->count - job->written >= job->window)
+            pthread_cond_wait(&job->changed, &job->lock);
+        pthread_mutex_unlock(&job->lock);
+
+        more = ndjson_read_batch(job, &b);
+
+        pthread_mutex_lock(&job->lock);
+
+        if (more)
+            job->batches[job->count++ % job->window] = b;
+        else
+            job->finished = 1;
+
+        pthread_cond_broadcast(&job->changed);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    STATS_MERGE();
+    return NULL;
+}
+
+// Writes a parsed batch, numbering its error reports from *line on, and
+// releases it. Returns the number of lines that failed.
+size_t write_ndjson_batch(Writer *w, NdjsonBatch *b, size_t *line) {
+    size_t from = 0;
+    size_t failed = b->errors.size;
+
+    for (size_t e = 0; e < b->errors.size; e++) {
+        NdjsonError *error = &b->errors.data[e];
+        char prefix[32];
+
+        writer_write(w, b->output.data + from, error->at - from);
+        writer_write(w, prefix,
+                     snprintf(prefix, sizeof(prefix), "line %zu:",
+                              *line + error->line));
+        from = error->at;
+    }
+
+    writer_write(w, b->output.data + from, b->output.size - from);
+    *line += b->lines;
+
+    free_writer(&b->output);
+    free_list_NdjsonError(&b->errors);
+
+    if (b->owned)
+        free(b->input);
+
+    return failed;
+}
+
+void flush_ndjson_output(Writer *w) {
+    writer_flush(w);
+
+    if (w->out != NULL)
+        fflush(w->out);
+}
+
+// Whether batch i can be written, or is past the last one.
+int ndjson_ready(NdjsonJob *job, size_t i) {
+    return i < job->count ? job->batches[i % job->window].done
+                          : job->finished;
+}
+
+// Parses every line of s on `threads` threads and writes each document, or
+// the report of what is wrong with it, to w. Returns the number of lines
+// that failed. With no threads, or if they can't be started, everything
+// happens on the calling thread instead.
+size_t parse_ndjson(Stream *s, Writer *w, int threads, int validate) {
+    NdjsonJob job = {.stream = s,
+                     .pending = create_list_char(0),
+                     .indent = w->indent,
+                     .validate = validate,
+                     .window = (size_t)threads * NDJSON_BATCHES_AHEAD};
+    pthread_t *workers = malloc(sizeof(pthread_t) * (threads + 1));
+    int started = 0;
+    size_t line = 1;
+    size_t failed = 0;
+    NdjsonBatch b;
+
+    // Anything the stream has read already starts the first batch.
+    if (s->source != NULL && s->size > s->current_position) {
+        size_t buffered = s->size - s->current_position;
+
+        reserve_list_char(&job.pending, buffered);
+        memcpy(job.pending.data, s->data + (s->current_position - s->offset),
+               buffered);
+        job.pending.size = buffered;
+        s->current_position = s->size;
+    }
+
+    job.batches = calloc(job.window, sizeof(NdjsonBatch));
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+
+    while (started < threads &&
+           pthread_create(&workers[started], NULL, ndjson_worker, &job) == 0)
+        started++;
+
+    if (started == 0 ||
+        pthread_create(&workers[started], NULL, ndjson_reader, &job) != 0) {
+        pthread_mutex_lock(&job.lock);
+        job.finished = 1;
+        pthread_cond_broadcast(&job.changed);
+        pthread_mutex_unlock(&job.lock);
+
+        for (int i = 0; i < started; i++)
+            pthread_join(workers[i], NULL);
+
+        Arena arena = create_arena();
+
+        while (ndjson_read_batch(&job, &b)) {
+            parse_ndjson_batch(&job, &b, &arena);
+            failed += write_ndjson_batch(w, &b, &line);
+            flush_ndjson_output(w);
+        }
+
+        free_arena(&arena);
+        started = -1;
+    }
+
+    for (size_t i = 0; started >= 0; i++) {
+        pthread_mutex_lock(&job.lock);
+
+        // Before waiting on the input, what is written already goes out.
+        if (!ndjson_ready(&job, i)) {
+            pthread_mutex_unlock(&job.lock);
+            flush_ndjson_output(w);
+            pthread_mutex_lock(&job.lock);
+
+            while (!ndjson_ready(&job, i))
+                pthread_cond_wait(&job.changed, &job.lock);
+        }
+
+        int end = i == job.count;
+        b = job.batches[i % job.window];
+        pthread_mutex_unlock(&job.lock);
+
+        if (end)
+            break;
+
+        failed += write_ndjson_batch(w, &b, &line);
+
+        pthread_mutex_lock(&job.lock);
+        job.written++;
+        pthread_cond_broadcast(&job.changed);
+        pthread_mutex_unlock(&job.lock);
+    }
+
+    for (int i = 0; i <= started; i++)
+        pthread_join(workers[i], NULL);
+
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.changed);
+    free_list_char(&job.pending);
+    free(workers);
+    free(job.batches);
+    return failed;
+}
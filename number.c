@@ -0,0 +1,730 @@
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Numbers
+//
+// Integers that fit are kept exact, as int64 or (above INT64_MAX) uint64.
+// Everything else becomes a double. Up to 19 significant digits are
+// converted with Clinger's fast path or the Eisel-Lemire algorithm. Longer
+// mantissas, and the rare cases those can't decide, go through strtod.
+
+typedef enum { NUMBER_INT, NUMBER_UINT, NUMBER_DOUBLE } NumberType;
+
+typedef struct {
+    NumberType type;
+    union {
+        int64_t value;
+        uint64_t unsigned_value;
+        double double_value;
+    };
+} JsonNumber;
+
+#define SMALLEST_POWER_OF_TEN -342
+#define LARGEST_POWER_OF_TEN 308
+// Formatting the smallest subnormals needs powers up to 10^324, past any
+// that parsing uses.
+#define LARGEST_TABLE_POWER_OF_TEN 324
+#define POWER_OF_FIVE_COUNT                                                    \
+    (LARGEST_TABLE_POWER_OF_TEN - SMALLEST_POWER_OF_TEN + 1)
+
+// The 128 most significant bits of 5^q for every q, stored high word first.
+// Negative powers are rounded up as the algorithm requires.
+uint64_t power_of_five_128[2 * POWER_OF_FIVE_COUNT];
+
+// Little-endian 32-bit limbs, enough for 2^BIG_BITS.
+#define BIG_BITS 1856
+#define BIG_LIMBS (BIG_BITS / 32 + 1)
+
+typedef struct {
+    uint32_t limbs[BIG_LIMBS];
+    int size;
+} BigNumber;
+
+int big_bit_length(BigNumber *b) {
+    if (b->size == 0)
+        return 0;
+
+    return 32 * (b->size - 1) + 32 - __builtin_clz(b->limbs[b->size - 1]);
+}
+
+void big_multiply_small(BigNumber *b, uint32_t factor) {
+    uint64_t carry = 0;
+
+    for (int i = 0; i < b->size; i++) {
+        uint64_t product = (uint64_t)b->limbs[i] * factor + carry;
+        b->limbs[i] = (uint32_t)product;
+        carry = product >> 32;
+    }
+
+    if (carry)
+        b->limbs[b->size++] = (uint32_t)carry;
+}
+
+void big_divide_small(BigNumber *b, uint32_t divisor) {
+    uint64_t remainder = 0;
+
+    for (int i = b->size - 1; i >= 0; i--) {
+        uint64_t current = remainder << 32 | b->limbs[i];
+        b->limbs[i] = (uint32_t)(current / divisor);
+        remainder = current % divisor;
+    }
+
+    while (b->size > 0 && b->limbs[b->size - 1] == 0)
+        b->size--;
+}
+
+int big_bit(BigNumber *b, int bit) {
+    if (bit < 0 || bit >= 32 * b->size)
+        return 0;
+
+    return b->limbs[bit / 32] >> (bit % 32) & 1;
+}
+
+// Bits [low, low + 128) of b; bits below zero read as zero.
+void big_bits_128(BigNumber *b, int low, uint64_t *high_out,
+                  uint64_t *low_out) {
+    uint64_t high = 0, lower = 0;
+
+    for (int i = 127; i >= 0; i--) {
+        uint64_t bit = big_bit(b, low + i);
+
+        if (i >= 64)
+            high |= bit << (i - 64);
+        else
+            lower |= bit << i;
+    }
+
+    *high_out = high;
+    *low_out = lower;
+}
+
+// floor(b / 2^shift) + 1
+void big_shift_right_plus_one(BigNumber *b, int shift, BigNumber *out) {
+    *out = (BigNumber){0};
+
+    for (int bit = big_bit_length(b) - 1; bit >= shift; bit--)
+        if (big_bit(b, bit))
+            out->limbs[(bit - shift) / 32] |= (uint32_t)1 << ((bit - shift) % 32);
+
+    out->size = BIG_LIMBS;
+    for (int i = 0; i < BIG_LIMBS; i++) {
+        if (++out->limbs[i] != 0)
+            break;
+    }
+
+    while (out->size > 0 && out->limbs[out->size - 1] == 0)
+        out->size--;
+}
+
+// Appendix B of Lemire, "Number Parsing at a Gigabyte per Second". For
+// q < 0 the entry is floor(2^b / 5^-q) + 1 truncated to 128 bits, where b
+// is chosen from the bit length z of 5^-q. floor(2^b / 5^n) is derived from
+// floor(2^BIG_BITS / 5^n), which repeated exact division by 5 produces.
+__attribute__((constructor)) void init_power_of_five_table() {
+    BigNumber power = {.limbs = {1}, .size = 1};
+    BigNumber inverse = {0};
+    BigNumber shifted;
+
+    inverse.limbs[BIG_BITS / 32] = (uint32_t)1 << (BIG_BITS % 32);
+    inverse.size = BIG_BITS / 32 + 1;
+
+    for (int n = 1; n <= -SMALLEST_POWER_OF_TEN; n++) {
+        big_multiply_small(&power, 5);
+        big_divide_small(&inverse, 5);
+
+        int z = big_bit_length(&power);
+        int b = n <= 27 ? z + 127 : 2 * z + 128;
+        uint64_t *entry = &power_of_five_128[2 * (-n - SMALLEST_POWER_OF_TEN)];
+
+        big_shift_right_plus_one(&inverse, BIG_BITS - b, &shifted);
+
+        int length = big_bit_length(&shifted);
+        big_bits_128(&shifted, length > 128 ? length - 128 : 0, &entry[0],
+                     &entry[1]);
+    }
+
+    power = (BigNumber){.limbs = {1}, .size = 1};
+
+    for (int q = 0; q <= LARGEST_TABLE_POWER_OF_TEN; q++) {
+        uint64_t *entry = &power_of_five_128[2 * (q - SMALLEST_POWER_OF_TEN)];
+
+        big_bits_128(&power, big_bit_length(&power) - 128, &entry[0],
+                     &entry[1]);
+        big_multiply_small(&power, 5);
+    }
+}
+
+// Returns -1 when the result can't be decided from 64 bits of mantissa.
+int eisel_lemire(int64_t q, uint64_t w, int negative, double *out) {
+    uint64_t mantissa;
+    int64_t power2;
+
+    if (w == 0 || q < SMALLEST_POWER_OF_TEN) {
+        mantissa = 0;
+        power2 = 0;
+    } else if (q > LARGEST_POWER_OF_TEN) {
+        mantissa = 0;
+        power2 = 0x7FF;
+    } else {
+        int lz = __builtin_clzll(w);
+        w <<= lz;
+
+        const uint64_t *entry =
+            &power_of_five_128[2 * (q - SMALLEST_POWER_OF_TEN)];
+        unsigned __int128 first = (unsigned __int128)w * entry[0];
+        uint64_t high = first >> 64, low = (uint64_t)first;
+        const uint64_t precision_mask = UINT64_MAX >> 55;
+
+        if ((high & precision_mask) == precision_mask) {
+            unsigned __int128 second = (unsigned __int128)w * entry[1];
+            uint64_t second_high = second >> 64;
+
+            low += second_high;
+            if (second_high > low)
+                high++;
+
+            if (low == UINT64_MAX && (q < -27 || q > 55))
+                return -1;
+        }
+
+        int upperbit = high >> 63;
+        int shift = upperbit + 64 - 52 - 3;
+
+        mantissa = high >> shift;
+        power2 = (((152170 + 65536) * q) >> 16) + 63 + upperbit - lz + 1023;
+
+        if (power2 <= 0) {
+            // Subnormal
+            if (-power2 + 1 >= 64) {
+                mantissa = 0;
+                power2 = 0;
+            } else {
+                mantissa >>= -power2 + 1;
+                mantissa += mantissa & 1;
+                mantissa >>= 1;
+                power2 = mantissa < ((uint64_t)1 << 52) ? 0 : 1;
+            }
+        } else {
+            // Exactly halfway between two doubles: round to even.
+            if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+                (mantissa << shift) == high)
+                mantissa &= ~(uint64_t)1;
+
+            mantissa += mantissa & 1;
+            mantissa >>= 1;
+
+            if (mantissa >= ((uint64_t)2 << 52)) {
+                mantissa = (uint64_t)1 << 52;
+                power2++;
+            }
+
+            mantissa &= ~((uint64_t)1 << 52);
+
+            if (power2 >= 0x7FF) {
+                mantissa = 0;
+                power2 = 0x7FF;
+            }
+        }
+    }
+
+    uint64_t bits = mantissa | (uint64_t)power2 << 52 |
+                    (uint64_t)(negative ? 1 : 0) << 63;
+    memcpy(out, &bits, sizeof(bits));
+    return 0;
+}
+
+double strtod_slice(const char *p, size_t size) {
+    char buffer[128];
+    char *text = size < sizeof(buffer) ? buffer : malloc(size + 1);
+
+    memcpy(text, p, size);
+    text[size] = '\0';
+
+    double result = strtod(text, NULL);
+
+    if (text != buffer)
+        free(text);
+
+    return result;
+}
+
+static const double exact_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+double digits_to_double(int64_t q, uint64_t w, int negative, const char *text,
+                        size_t size, int truncated) {
+    double result;
+
+    if (truncated)
+        return strtod_slice(text, size);
+
+    // Clinger: both operands are exact, so is the one rounding.
+    if (q >= -22 && q <= 22 && w <= (uint64_t)1 << 53) {
+        result = (double)w;
+        result = q < 0 ? result / exact_powers_of_ten[-q]
+                       : result * exact_powers_of_ten[q];
+        return negative ? -result : result;
+    }
+
+    if (eisel_lemire(q, w, negative, &result) < 0)
+        return strtod_slice(text, size);
+
+    return result;
+}
+
+static inline int is_digit_byte(char c) { return c >= '0' && c <= '9'; }
+
+// Bytes that can appear somewhere in a number.
+static inline int is_number_byte(char c) {
+    return is_digit_byte(c) || c == '-' || c == '+' || c == '.' || c == 'e' ||
+           c == 'E';
+}
+
+// Parses the number at the start of p. On success returns 1 and sets *used
+// to its length; otherwise returns 0 with *used at the offending byte.
+int parse_number_text(const char *p, size_t size, JsonNumber *out,
+                      size_t *used) {
+    size_t i = 0;
+    int negative = 0;
+
+    if (i < size && p[i] == '-') {
+        negative = 1;
+        i++;
+    }
+
+    size_t digits_start = i;
+    uint64_t w = 0;
+
+    // A leading zero is the whole integer part.
+    if (i < size && p[i] == '0') {
+        i++;
+    } else {
+        while (i < size && is_digit_byte(p[i])) {
+            w = w * 10 + (p[i] - '0');
+            i++;
+        }
+    }
+
+    size_t integer_end = i;
+
+    if (integer_end == digits_start) {
+        *used = i;
+        return 0;
+    }
+
+    int is_integer = i == size || (p[i] != '.' && p[i] != 'e' && p[i] != 'E');
+
+    // Short integers, by far the most common case, stop here.
+    if (is_integer && integer_end - digits_start <= 18) {
+        out->type = NUMBER_INT;
+        out->value = negative ? -(int64_t)w : (int64_t)w;
+        *used = i;
+        return 1;
+    }
+
+    // Long integers and anything with a fraction or exponent.
+    size_t significant = 0;
+    int64_t exponent = 0;
+    int truncated = 0;
+
+    w = 0;
+
+    for (i = digits_start; i < integer_end; i++) {
+        if (significant < 19) {
+            w = w * 10 + (p[i] - '0');
+            if (w != 0)
+                significant++;
+        } else {
+            exponent++;
+            truncated |= p[i] != '0';
+        }
+    }
+
+    if (is_integer) {
+        uint64_t exact;
+        int overflow = 0;
+
+        // Up to 20 digits still fit in a uint64.
+        exact = 0;
+        for (size_t d = digits_start; d < i && !overflow; d++)
+            overflow = __builtin_mul_overflow(exact, 10, &exact) ||
+                       __builtin_add_overflow(exact, p[d] - '0', &exact);
+
+        *used = i;
+
+        if (!overflow && !negative && exact <= INT64_MAX) {
+            out->type = NUMBER_INT;
+            out->value = (int64_t)exact;
+            return 1;
+        }
+
+        if (!overflow && !negative) {
+            out->type = NUMBER_UINT;
+            out->unsigned_value = exact;
+            return 1;
+        }
+
+        if (!overflow && exact <= (uint64_t)INT64_MAX + 1) {
+            out->type = NUMBER_INT;
+            out->value = (int64_t)(0 - exact);
+            return 1;
+        }
+
+        double result = digits_to_double(exponent, w, negative, p, i, truncated);
+
+        // As below, too many digits for a double are an error, not inf.
+        if (isinf(result)) {
+            *used = 0;
+            return 0;
+        }
+
+        out->type = NUMBER_DOUBLE;
+        out->double_value = result;
+        return 1;
+    }
+
+    if (i < size && p[i] == '.') {
+        i++;
+
+        size_t fraction_start = i;
+
+        while (i < size && is_digit_byte(p[i])) {
+            if (significant < 19) {
+                w = w * 10 + (p[i] - '0');
+                exponent--;
+                if (w != 0)
+                    significant++;
+            } else {
+                truncated |= p[i] != '0';
+            }
+            i++;
+        }
+
+        if (i == fraction_start) {
+            *used = i;
+            return 0;
+        }
+    }
+
+    if (i < size && (p[i] == 'e' || p[i] == 'E')) {
+        int64_t explicit_exponent = 0;
+        int exponent_negative = 0;
+
+        i++;
+
+        if (i < size && (p[i] == '+' || p[i] == '-')) {
+            exponent_negative = p[i] == '-';
+            i++;
+        }
+
+        size_t exponent_start = i;
+
+        while (i < size && is_digit_byte(p[i])) {
+            if (explicit_exponent < 100000)
+                explicit_exponent = explicit_exponent * 10 + (p[i] - '0');
+            i++;
+        }
+
+        if (i == exponent_start) {
+            *used = i;
+            return 0;
+        }
+
+        exponent += exponent_negative ? -explicit_exponent : explicit_exponent;
+    }
+
+    double result = digits_to_double(exponent, w, negative, p, i, truncated);
+
+    // Too large for a double; don't let it turn into inf.
+    if (isinf(result)) {
+        *used = 0;
+        return 0;
+    }
+
+    out->type = NUMBER_DOUBLE;
+    out->double_value = result;
+    *used = i;
+    return 1;
+}
+
+// Formatting doubles
+//
+// Grisu2, from Loitsch, "Printing Floating-Point Numbers Quickly and
+// Accurately with Integers". The double and the boundaries of the interval
+// that rounds to it are scaled by a cached power of ten into a range where
+// digits come out of 64-bit integer arithmetic, and digits are generated
+// until the number is inside the interval, narrowed by the error of the
+// scaling. The result always reads back as the same double and is nearly
+// always the shortest that does. The cached powers are the high words of
+// the power_of_five_128 table that parsing uses.
+
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+// The product, rounded to its high 64 bits.
+DiyFp diy_multiply(DiyFp a, DiyFp b) {
+    unsigned __int128 p = (unsigned __int128)a.f * b.f;
+    uint64_t high = p >> 64;
+
+    high += (uint64_t)p >> 63;
+    return (DiyFp){high, a.e + b.e + 64};
+}
+
+DiyFp diy_normalize(DiyFp x) {
+    int shift = __builtin_clzll(x.f);
+    return (DiyFp){x.f << shift, x.e - shift};
+}
+
+// Exponents after scaling stay in [GRISU_ALPHA, GRISU_GAMMA], so that the
+// integer part of the scaled upper boundary fits in 32 bits.
+#define GRISU_ALPHA -60
+#define GRISU_GAMMA -32
+
+// 10^-k, normalized, for the k that scales numbers with binary exponent e
+// into range.
+DiyFp grisu_cached_power(int e, int *k) {
+    int f = GRISU_ALPHA - e - 1;
+    // ceil(f * log10(2))
+    int q = (f * 78913) / (1 << 18) + (f > 0);
+    const uint64_t *entry = &power_of_five_128[2 * (q - SMALLEST_POWER_OF_TEN)];
+    DiyFp c = {entry[0] + (entry[1] >> 63),
+               (int)(((int64_t)217706 * q) >> 16) - 63};
+
+    // Rounding the high word up carried out of it.
+    if (c.f == 0) {
+        c.f = (uint64_t)1 << 63;
+        c.e++;
+    }
+
+    *k = -q;
+    return c;
+}
+
+// Moves the last digit down while that brings the number closer to w and
+// keeps it inside the interval.
+void grisu_round(char *digits, int length, uint64_t distance, uint64_t delta,
+                 uint64_t rest, uint64_t ten_k) {
+    while (rest < distance && delta - rest >= ten_k &&
+           (rest + ten_k < distance ||
+            distance - rest > rest + ten_k - distance)) {
+        digits[length - 1]--;
+        rest += ten_k;
+    }
+}
+
+// Digits of a number inside (low, high) as close to w as they allow, all
+// three scaled to the same exponent. The number is digits * 10^exponent.
+int grisu_digits(char *digits, int *exponent, DiyFp low, DiyFp w,
+                 DiyFp high) {
+    uint64_t delta = high.f - low.f;
+    uint64_t distance = high.f - w.f;
+    uint64_t one = (uint64_t)1 << -high.e;
+    uint32_t integer = high.f >> -high.e;
+    uint64_t fraction = high.f & (one - 1);
+    uint32_t power = 1000000000;
+    int n = 10;
+    int length = 0;
+
+    while (power > integer && n > 1) {
+        power /= 10;
+        n--;
+    }
+
+    while (n > 0) {
+        digits[length++] = '0' + integer / power;
+        integer %= power;
+        n--;
+
+        uint64_t rest = ((uint64_t)integer << -high.e) + fraction;
+
+        if (rest <= delta) {
+            *exponent += n;
+            grisu_round(digits, length, distance, delta, rest,
+                        (uint64_t)power << -high.e);
+            return length;
+        }
+
+        power /= 10;
+    }
+
+    int m = 0;
+
+    while (1) {
+        fraction *= 10;
+        delta *= 10;
+        distance *= 10;
+        digits[length++] = '0' + (fraction >> -high.e);
+        fraction &= one - 1;
+        m++;
+
+        if (fraction <= delta)
+            break;
+    }
+
+    *exponent -= m;
+    grisu_round(digits, length, distance, delta, fraction, one);
+    return length;
+}
+
+// Digits of the positive, finite value, with *exponent set so that it is
+// digits * 10^exponent.
+int grisu2(double value, char *digits, int *exponent) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint64_t fraction = bits & (((uint64_t)1 << 52) - 1);
+    int biased = bits >> 52 & 0x7FF;
+    DiyFp v = biased ? (DiyFp){fraction | (uint64_t)1 << 52, biased - 1075}
+                     : (DiyFp){fraction, 1 - 1075};
+
+    // The interval is halfway to the neighbouring doubles, which is closer
+    // below at a power of two.
+    DiyFp high = diy_normalize((DiyFp){2 * v.f + 1, v.e - 1});
+    DiyFp low = fraction == 0 && biased > 1
+                    ? (DiyFp){4 * v.f - 1, v.e - 2}
+                    : (DiyFp){2 * v.f - 1, v.e - 1};
+
+    low.f <<= low.e - high.e;
+    low.e = high.e;
+
+    int k;
+    DiyFp c = grisu_cached_power(high.e, &k);
+    DiyFp w = diy_multiply(diy_normalize(v), c);
+    DiyFp scaled_low = diy_multiply(low, c);
+    DiyFp scaled_high = diy_multiply(high, c);
+
+    // Each product may be off by an ulp, so the interval shrinks by one on
+    // either side.
+    scaled_low.f++;
+    scaled_high.f--;
+
+    *exponent = k;
+    return grisu_digits(digits, exponent, scaled_low, w, scaled_high);
+}
+
+// Like the shortest %g that reads back as the same double: plain notation
+// for decimal exponents from -4 up to the number of digits, or 15 if that
+// is more, and scientific notation otherwise. NUL-terminates out.
+int format_double(double value, char *out) {
+    char digits[24];
+    int exponent, length = 0;
+
+    if (!isfinite(value))
+        return snprintf(out, 32, "%g", value);
+
+    if (signbit(value)) {
+        out[length++] = '-';
+        value = -value;
+    }
+
+    if (value == 0) {
+        out[length++] = '0';
+        out[length] = '\0';
+        return length;
+    }
+
+    int count = grisu2(value, digits, &exponent);
+
+    while (count > 1 && digits[count - 1] == '0') {
+        count--;
+        exponent++;
+    }
+
+    // The exponent of the first digit.
+    int point = count + exponent - 1;
+
+    if (point < -4 || point >= (count > 15 ? count : 15)) {
+        out[length++] = digits[0];
+
+        if (count > 1) {
+            out[length++] = '.';
+            memcpy(out + length, digits + 1, count - 1);
+            length += count - 1;
+        }
+
+        length += sprintf(out + length, "e%c%02d", point < 0 ? '-' : '+',
+                          point < 0 ? -point : point);
+    } else if (point < 0) {
+        memcpy(out + length, "0.0000", 1 - point);
+        length += 1 - point;
+        memcpy(out + length, digits, count);
+        length += count;
+    } else if (point + 1 >= count) {
+        memcpy(out + length, digits, count);
+        length += count;
+        memset(out + length, '0', point + 1 - count);
+        length += point + 1 - count;
+    } else {
+        memcpy(out + length, digits, point + 1);
+        length += point + 1;
+        out[length++] = '.';
+        memcpy(out + length, digits + point + 1, count - point - 1);
+        length += count - point - 1;
+    }
+
+    out[length] = '\0';
+    return length;
+}
+
+static const char digit_pairs[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+// Writes the digits two at a time from the end of a scratch buffer, then
+// moves them to out.
+int format_uint64(uint64_t value, char *out) {
+    char buffer[20];
+    char *p = buffer + sizeof(buffer);
+
+    while (value >= 100) {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * (value % 100), 2);
+        value /= 100;
+    }
+
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * value, 2);
+    } else {
+        *--p = '0' + value;
+    }
+
+    int length = buffer + sizeof(buffer) - p;
+    memcpy(out, p, length);
+    return length;
+}
+
+int format_int64(int64_t value, char *out) {
+    if (value >= 0)
+        return format_uint64(value, out);
+
+    *out = '-';
+    return 1 + format_uint64(-(uint64_t)value, out + 1);
+}
+
+// Writes n as JSON text into out, which must hold at least 32 bytes. The
+// text is not NUL-terminated.
+int format_number(const JsonNumber *n, char *out) {
+    switch (n->type) {
+    case NUMBER_INT:
+        return format_int64(n->value, out);
+    case NUMBER_UINT:
+        return format_uint64(n->unsigned_value, out);
+    default:
+        return format_double(n->double_value, out);
+    }
+}
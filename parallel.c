@@ -0,0 +1,356 @@
+// Parallel parsing
+//
+// Large documents whose root is an array are parsed on several threads. The
+// input is cut into equal chunks that are classified in parallel, each one
+// both as if it started outside a string and as if it started inside one.
+// The quote parity of the chunks before it then tells which case is right
+// for every chunk, giving the string state and nesting depth at its start.
+//
+// From there each thread finds the first comma between two items of the
+// root array in its chunk, and parses the items from that comma up to the
+// comma the next thread starts at, into its own arena. The pieces are then
+// copied into one array and the arenas merged into the stream's.
+//
+// Anything unexpected, including an error in any item, sends the whole
+// document through parse_json_structural instead, so that errors are
+// reported exactly as a single thread reports them.
+
+#define PARALLEL_MIN_SIZE (1 << 20)
+
+int parallel_threads = 0;
+
+typedef struct {
+    Stream *stream;
+    size_t start;
+    size_t end;
+
+    // Set by classify_chunk; index 0 assumes the chunk starts outside a
+    // string, index 1 inside one.
+    int odd_quotes;
+    long depth_change[2];
+
+    // State at start, worked out from the chunks before.
+    int in_string;
+    long depth;
+
+    // Position of the root comma this chunk's items start after, or of the
+    // root's closing bracket if there is none, and of the one they end at.
+    size_t split;
+    size_t until;
+    size_t close;
+
+    Stream view;
+    Json *items;
+    size_t count;
+    ParseResult result;
+} ParallelChunk;
+
+// Whether the byte at position is escaped, from the backslashes before it.
+uint64_t escaped_at(Stream *s, size_t position) {
+    size_t backslashes = 0;
+
+    while (position - backslashes > s->offset &&
+           stream_byte(s, position - backslashes - 1) == '\\')
+        ++backslashes;
+
+    return backslashes & 1;
+}
+
+// Calls f(context, position, byte, outside) for every operator byte from
+// start to end. outside is 1 if the byte is outside a string when start is,
+// and 2 if it is outside a string when start is inside one. Stops when f
+// returns 0 and returns where.
+size_t for_each_operator(Stream *s, size_t start, size_t end,
+                         int (*f)(void *, size_t, char, int), void *context,
+                         int *odd_quotes) {
+    ScanState state = {.escaped = escaped_at(s, start)};
+    int quotes = 0;
+
+    for (size_t i = start; i < end; i += 64) {
+        const char *block = s->data + (i - s->offset);
+        char padded[64];
+
+        if (end - i < 64) {
+            memset(padded, ' ', sizeof(padded));
+            memcpy(padded, block, end - i);
+            block = padded;
+        }
+
+        BlockMasks m;
+        classify_block(block, &m);
+
+        uint64_t escaped = find_escaped(m.backslash, &state.escaped);
+        uint64_t quote = m.quote & ~escaped;
+        uint64_t in_string = prefix_xor(quote) ^ state.in_string;
+        state.in_string = (uint64_t)((int64_t)in_string >> 63);
+        quotes += __builtin_popcountll(quote);
+
+        for (uint64_t op = m.op; op; op &= op - 1) {
+            int bit = __builtin_ctzll(op);
+            int outside = in_string >> bit & 1 ? 2 : 1;
+
+            if (!f(context, i + bit, block[bit], outside)) {
+                if (odd_quotes != NULL)
+                    *odd_quotes = quotes & 1;
+
+                return i + bit;
+            }
+        }
+    }
+
+    if (odd_quotes != NULL)
+        *odd_quotes = quotes & 1;
+
+    return end;
+}
+
+int count_depth(void *context, size_t position, char c, int outside) {
+    ParallelChunk *chunk = context;
+    int change = c == '[' || c == '{' ? 1 : c == ']' || c == '}' ? -1 : 0;
+
+    (void)position;
+    chunk->depth_change[outside == 1 ? 0 : 1] += change;
+    return 1;
+}
+
+void *classify_chunk(void *context) {
+    ParallelChunk *chunk = context;
+
+    for_each_operator(chunk->stream, chunk->start, chunk->end, count_depth,
+                      chunk, &chunk->odd_quotes);
+    STATS_MERGE();
+    return NULL;
+}
+
+int find_root_comma(void *context, size_t position, char c, int outside) {
+    ParallelChunk *chunk = context;
+    int wanted = chunk->in_string ? 2 : 1;
+
+    (void)position;
+
+    if (outside != wanted)
+        return 1;
+
+    if (c == ',' && chunk->depth == 1)
+        return 0;
+
+    if (c == '[' || c == '{')
+        chunk->depth++;
+    else if (c == ']' || c == '}')
+        chunk->depth--;
+
+    // The root closed.
+    return chunk->depth != 0;
+}
+
+void *find_split(void *context) {
+    ParallelChunk *chunk = context;
+    long depth = chunk->depth;
+
+    chunk->split = for_each_operator(chunk->stream, chunk->start,
+                                     chunk->stream->size, find_root_comma,
+                                     chunk, NULL);
+    chunk->depth = depth;
+    STATS_MERGE();
+    return NULL;
+}
+
+// Items from after split up to until. A chunk whose split is the same as
+// the next one's is inside a single item that an earlier chunk parses.
+// Otherwise only the last chunk may reach until straight after a comma or
+// the opening bracket, in an empty array or after a trailing comma.
+void *parse_chunk(void *context) {
+    ParallelChunk *chunk = context;
+    Stream *s = &chunk->view;
+    Arena *arena = &s->arena;
+    int last = chunk->until == chunk->close;
+    Json item;
+
+    chunk->result = PARSED;
+
+    if (chunk->split == chunk->until) {
+        STATS_MERGE();
+        return NULL;
+    }
+
+    // Items are already inside the root array.
+    IndexWalker w = {.stream = s,
+                     .scanned = chunk->split + 1,
+                     .index = create_list_size_t(STRUCTURAL_BATCH_SIZE / 4),
+                     .depth = 1};
+
+    while (chunk->result == PARSED) {
+        if (walker_position(&w) == chunk->until) {
+            if (!last)
+                chunk->result = ERROR;
+            break;
+        }
+
+        if ((chunk->result = walk_value(&w, &item)) != PARSED)
+            break;
+
+        arena_scratch_push(arena, &item, sizeof(item));
+        chunk->count++;
+
+        if (walker_position(&w) == chunk->until)
+            break;
+
+        if (!walker_eat(&w, ','))
+            chunk->result = ERROR;
+    }
+
+    chunk->items = arena_scratch_commit(arena, 0);
+    free_list_size_t(&w.index);
+    STATS_MERGE();
+    return NULL;
+}
+
+// Threads get a main thread's stack whatever the default is, as parse_chunk
+// recurses once per level up to json_max_depth.
+#define PARALLEL_STACK_SIZE (8 << 20)
+
+void run_parallel(void *(*f)(void *), ParallelChunk *chunks, int count) {
+    pthread_t *threads = malloc(sizeof(pthread_t) * count);
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PARALLEL_STACK_SIZE);
+
+    for (int i = 0; i < count; i++)
+        pthread_create(&threads[i], &attr, f, &chunks[i]);
+
+    for (int i = 0; i < count; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_attr_destroy(&attr);
+    free(threads);
+}
+
+// Works out where every chunk starts parsing. Returns 0 if the document
+// doesn't look like an array that can be split.
+int plan_chunks(Stream *s, ParallelChunk *chunks, int count) {
+    size_t root = s->current_position + skip_whitespace(
+        s->data + (s->current_position - s->offset),
+        s->size - s->current_position);
+    size_t end = s->size;
+
+    while (end > root && is_whitespace_byte(stream_byte(s, end - 1)))
+        --end;
+
+    if (root + 1 >= end || stream_byte(s, root) != '[' ||
+        stream_byte(s, end - 1) != ']')
+        return 0;
+
+    size_t size = end - root;
+
+    for (int i = 0; i < count; i++) {
+        chunks[i] = (ParallelChunk){
+            .stream = s,
+            .start = root + size * i / count,
+            .end = root + size * (i + 1) / count};
+    }
+
+    run_parallel(classify_chunk, chunks, count);
+
+    int in_string = 0;
+    long depth = 0;
+
+    for (int i = 0; i < count; i++) {
+        chunks[i].in_string = in_string;
+        chunks[i].depth = depth;
+        depth += chunks[i].depth_change[in_string];
+        in_string ^= chunks[i].odd_quotes;
+    }
+
+    if (in_string || depth != 0)
+        return 0;
+
+    run_parallel(find_split, chunks + 1, count - 1);
+    chunks[0].split = root;
+
+    for (int i = 0; i < count; i++) {
+        chunks[i].close = end - 1;
+        chunks[i].until = i + 1 < count ? chunks[i + 1].split : end - 1;
+
+        if (chunks[i].split > chunks[i].until)
+            return 0;
+    }
+
+    return 1;
+}
+
+// Documents smaller than min_size aren't worth starting threads for and are
+// parsed by parse_json_structural alone.
+ParseResult parse_json_parallel_threads(Stream *s, Json *out, int threads,
+                                        size_t min_size) {
+    stream_load_all(s);
+
+    if (threads < 2 || s->size - s->current_position < min_size)
+        return parse_json_structural(s, out);
+
+    ParallelChunk *chunks = calloc(threads, sizeof(ParallelChunk));
+    int planned = plan_chunks(s, chunks, threads);
+    ParseResult result = planned ? PARSED : ERROR;
+
+    if (planned) {
+        for (int i = 0; i < threads; i++) {
+            chunks[i].view = *s;
+            chunks[i].view.arena = create_arena();
+            // A KeyTable can't be shared between threads, so keys parsed
+            // here are not interned.
+            chunks[i].view.keys = NULL;
+        }
+
+        run_parallel(parse_chunk, chunks, threads);
+
+        for (int i = 0; i < threads; i++)
+            if (chunks[i].result != PARSED)
+                result = ERROR;
+    }
+
+    if (result == PARSED) {
+        size_t total = 0;
+
+        for (int i = 0; i < threads; i++)
+            total += chunks[i].count;
+
+        Json *items = total ? arena_alloc(&s->arena, sizeof(Json) * total)
+                            : NULL;
+        size_t at = 0;
+
+        for (int i = 0; i < threads; i++) {
+            // A chunk inside a single item has nothing to copy.
+            if (chunks[i].count > 0)
+                memcpy(items + at, chunks[i].items,
+                       sizeof(Json) * chunks[i].count);
+
+            at += chunks[i].count;
+            arena_adopt(&s->arena, &chunks[i].view.arena);
+        }
+
+        out->variant = ARRAY;
+        out->value.j_array.data = items;
+        out->value.j_array.size = total;
+        out->value.j_array.capacity = total;
+        s->current_position = s->size;
+    } else {
+        for (int i = 0; planned && i < threads; i++)
+            free_arena(&chunks[i].view.arena);
+    }
+
+    free(chunks);
+
+    if (result != PARSED)
+        return parse_json_structural(s, out);
+
+    return result;
+}
+
+ParseResult parse_json_parallel(Stream *s, Json *out) {
+    int threads = parallel_threads;
+
+    if (threads < 1)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return parse_json_parallel_threads(s, out, threads, PARALLEL_MIN_SIZE);
+}
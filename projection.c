@@ -0,0 +1,418 @@
+// Projection
+//
+// Parses only the parts of a document that some path asks for. Paths are
+// either JSONPath-like ("$.users[*].email", with ".key", ".*", "[n]" and
+// "[*]" steps) or JSON Pointers ("/users/0/email"). Every step descends one
+// level, so at depth d the paths still alive are exactly those whose first d
+// steps matched, and are kept as a bit mask.
+//
+// A value that completes a path is built in full. Containers on the way to
+// one are kept with only the members and items that lead somewhere, and
+// everything else is skipped by skip_value, which balances brackets and
+// quotes without allocating or looking inside strings. Skipped values are
+// therefore not validated beyond that.
+//
+// A value that nothing was selected from is dropped, whatever its type, so
+// a container on the way that ends up empty goes too: "$[*].a" over
+// [{"b": 1}, 2, {"a": 3}] gives [{"a": 3}]. Positions in a projected array
+// are therefore not those in the document. A root that nothing is selected
+// from comes out as null.
+
+#define PROJECTION_MAX_PATHS 64
+
+typedef struct {
+    // Object key as it appears in the document, escapes included, or NULL.
+    char *key;
+    size_t size;
+    // Array index, or SIZE_MAX.
+    size_t index;
+    int any;
+} PathStep;
+
+LIST(PathStep);
+CREATE_LIST(PathStep);
+APPEND_LIST(PathStep);
+FREE_LIST(PathStep);
+
+typedef struct {
+    List_PathStep paths[PROJECTION_MAX_PATHS];
+    size_t count;
+} Projection;
+
+void free_projection(Projection *p) {
+    for (size_t i = 0; i < p->count; i++) {
+        for (size_t j = 0; j < p->paths[i].size; j++)
+            free(p->paths[i].data[j].key);
+
+        free_list_PathStep(&p->paths[i]);
+    }
+
+    p->count = 0;
+}
+
+int parse_path_index(const char *text, size_t size, size_t *out) {
+    size_t index = 0;
+
+    if (size == 0 || (size > 1 && text[0] == '0'))
+        return 0;
+
+    for (size_t i = 0; i < size; i++) {
+        if (text[i] < '0' || text[i] > '9' || index > (SIZE_MAX - 9) / 10)
+            return 0;
+
+        index = index * 10 + (text[i] - '0');
+    }
+
+    *out = index;
+    return 1;
+}
+
+// A Pointer token names a member, or an item when it is an index. "~1" and
+// "~0" stand for '/' and '~', which are the same in an escaped key.
+PathStep pointer_step(const char *token, size_t size) {
+    PathStep step = {.key = malloc(size + 1), .index = SIZE_MAX};
+
+    for (size_t i = 0; i < size; i++) {
+        if (token[i] == '~' && i + 1 < size &&
+            (token[i + 1] == '0' || token[i + 1] == '1'))
+            step.key[step.size++] = token[++i] == '0' ? '~' : '/';
+        else
+            step.key[step.size++] = token[i];
+    }
+
+    parse_path_index(token, size, &step.index);
+    return step;
+}
+
+int parse_pointer(const char *path, List_PathStep *steps) {
+    while (*path == '/') {
+        const char *token = ++path;
+
+        while (*path != '\0' && *path != '/')
+            ++path;
+
+        append_list_PathStep(steps, pointer_step(token, path - token));
+    }
+
+    return *path == '\0';
+}
+
+int parse_dotted_path(const char *path, List_PathStep *steps) {
+    while (*path != '\0') {
+        PathStep step = {.index = SIZE_MAX};
+        const char *start = path + 1;
+
+        if (*path == '.') {
+            path = start;
+
+            while (*path != '\0' && *path != '.' && *path != '[')
+                ++path;
+
+            if (path == start)
+                return 0;
+
+            if (path - start == 1 && *start == '*') {
+                step.any = 1;
+            } else {
+                step.size = path - start;
+                step.key = malloc(step.size);
+                memcpy(step.key, start, step.size);
+            }
+        } else if (*path == '[') {
+            const char *end = strchr(start, ']');
+
+            if (end == NULL)
+                return 0;
+
+            if (end - start == 1 && *start == '*')
+                step.any = 1;
+            else if (!parse_path_index(start, end - start, &step.index))
+                return 0;
+
+            path = end + 1;
+        } else {
+            return 0;
+        }
+
+        append_list_PathStep(steps, step);
+    }
+
+    return 1;
+}
+
+// Adds a path to p. Returns 0, leaving p as it was, if the path can't be
+// parsed or p is full.
+int projection_add(Projection *p, const char *path) {
+    if (p->count == PROJECTION_MAX_PATHS)
+        return 0;
+
+    List_PathStep *steps = &p->paths[p->count];
+    int parsed;
+
+    *steps = create_list_PathStep(0);
+
+    if (*path == '$')
+        parsed = parse_dotted_path(path + 1, steps);
+    else
+        parsed = parse_pointer(path, steps);
+
+    p->count++;
+
+    if (!parsed) {
+        p->count--;
+        for (size_t i = 0; i < steps->size; i++)
+            free(steps->data[i].key);
+
+        free_list_PathStep(steps);
+    }
+
+    return parsed;
+}
+
+// Skipping
+
+ParseResult skip_string(Stream *s) {
+    if (!eat_char(s, '"'))
+        return NOT_PARSED;
+
+    while (stream_ensure(s, 1)) {
+        char *p = s->data + (s->current_position - s->offset);
+        size_t available = s->size - s->current_position;
+        size_t run = find_string_special(p, available);
+
+        s->current_position += run;
+
+        if (run == available)
+            continue;
+
+        if (p[run] == '"') {
+            s->current_position += 1;
+            return PARSED;
+        }
+
+        if (!stream_ensure(s, 2))
+            break;
+
+        s->current_position += 2;
+    }
+
+    return ERROR;
+}
+
+// Moves past the value at the current position. Scalars are parsed as
+// usual, containers only have their brackets counted.
+ParseResult skip_value(Stream *s) {
+    Json scalar;
+    char c;
+    size_t depth = 0;
+
+    eat_whitespace(s);
+
+    if (!stream_peek(s, &c))
+        return ERROR;
+
+    if (c == '"')
+        return skip_string(s);
+
+    if (c != '[' && c != '{') {
+        JsonParser parser = json_parsers[(unsigned char)c];
+        return parser != NULL && parser(s, &scalar) == PARSED ? PARSED : ERROR;
+    }
+
+    while (stream_ensure(s, 1)) {
+        char *p = s->data + (s->current_position - s->offset);
+        size_t available = s->size - s->current_position;
+        size_t run = find_skip_special(p, available);
+
+        s->current_position += run;
+
+        if (run == available)
+            continue;
+
+        if (p[run] == '"') {
+            if (skip_string(s) != PARSED)
+                return ERROR;
+
+            continue;
+        }
+
+        s->current_position += 1;
+
+        if (p[run] == '[' || p[run] == '{')
+            depth++;
+        else if (--depth == 0)
+            return PARSED;
+    }
+
+    return ERROR;
+}
+
+// Building
+
+// Paths in alive that go on with a step matching the member key, or the item
+// at index when key is NULL.
+uint64_t projection_step(Projection *p, uint64_t alive, size_t depth,
+                         JsonString *key, size_t index) {
+    uint64_t next = 0;
+
+    for (uint64_t rest = alive; rest; rest &= rest - 1) {
+        int i = __builtin_ctzll(rest);
+        PathStep *step = &p->paths[i].data[depth];
+
+        if (step->any ||
+            (key == NULL ? step->index == index
+                         : step->key != NULL &&
+                               key_equals(key, step->key, step->size)))
+            next |= (uint64_t)1 << i;
+    }
+
+    return next;
+}
+
+ParseResult project_value(Stream *s, Projection *p, uint64_t alive,
+                          size_t depth, Json *out, int *kept);
+
+ParseResult project_array(Stream *s, Projection *p, uint64_t alive,
+                          size_t depth, Json *out) {
+    Arena *arena = &s->arena;
+    size_t mark = arena_scratch_mark(arena);
+    ParseResult result = PARSED;
+    Json item;
+    int kept;
+
+    eat_char(s, '[');
+
+    for (size_t i = 0; !eat_char_between_whitespace(s, ']'); i++) {
+        uint64_t next = projection_step(p, alive, depth, NULL, i);
+
+        if (next == 0)
+            result = skip_value(s);
+        else if ((result = project_value(s, p, next, depth + 1, &item,
+                                         &kept)) == PARSED &&
+                 kept)
+            arena_scratch_push(arena, &item, sizeof(item));
+
+        if (result != PARSED)
+            break;
+
+        if (!eat_char_between_whitespace(s, ',')) {
+            if (!eat_char_between_whitespace(s, ']'))
+                result = ERROR;
+            break;
+        }
+    }
+
+    if (result != PARSED) {
+        arena_scratch_pop(arena, mark);
+        return result;
+    }
+
+    out->variant = ARRAY;
+    out->value.j_array.size = (arena->scratch_size - mark) / sizeof(Json);
+    out->value.j_array.capacity = out->value.j_array.size;
+    out->value.j_array.data = arena_scratch_commit(arena, mark);
+    return PARSED;
+}
+
+ParseResult project_object(Stream *s, Projection *p, uint64_t alive,
+                           size_t depth, Json *out) {
+    Arena *arena = &s->arena;
+    size_t mark = arena_scratch_mark(arena);
+    ParseResult result = PARSED;
+    KeyValuePair kvp;
+    Json value;
+    int kept;
+
+    eat_char(s, '{');
+
+    while (!eat_char_between_whitespace(s, '}')) {
+        if (parse_key(s, &kvp.key) != PARSED ||
+            !eat_char_between_whitespace(s, ':')) {
+            result = ERROR;
+            break;
+        }
+
+        uint64_t next = projection_step(p, alive, depth, &kvp.key, 0);
+
+        if (next == 0) {
+            result = skip_value(s);
+        } else if ((result = project_value(s, p, next, depth + 1, &value,
+                                           &kept)) == PARSED &&
+                   kept) {
+            kvp.value = arena_copy(arena, &value, sizeof(value));
+            arena_scratch_push(arena, &kvp, sizeof(kvp));
+        }
+
+        if (result != PARSED)
+            break;
+
+        if (!eat_char_between_whitespace(s, ',')) {
+            if (!eat_char_between_whitespace(s, '}'))
+                result = ERROR;
+            break;
+        }
+    }
+
+    if (result != PARSED) {
+        arena_scratch_pop(arena, mark);
+        return result;
+    }
+
+    out->variant = OBJECT;
+    out->value.j_object.size =
+        (arena->scratch_size - mark) / sizeof(KeyValuePair);
+    out->value.j_object.data = arena_scratch_commit(arena, mark);
+    out->value.j_object.index = NULL;
+    index_large_object(arena, &out->value.j_object);
+    return PARSED;
+}
+
+// kept is 0 if nothing under the value was selected, in which case out is
+// to be ignored.
+ParseResult project_value(Stream *s, Projection *p, uint64_t alive,
+                          size_t depth, Json *out, int *kept) {
+    ParseResult result;
+    char c;
+
+    *kept = 1;
+
+    for (uint64_t rest = alive; rest; rest &= rest - 1)
+        if (p->paths[__builtin_ctzll(rest)].size == depth)
+            return parse_json(s, out);
+
+    eat_whitespace(s);
+
+    if (!stream_peek(s, &c))
+        return ERROR;
+
+    if ((c == '[' || c == '{') && depth == json_max_depth)
+        return ERROR;
+
+    if (c == '[') {
+        result = project_array(s, p, alive, depth, out);
+        *kept = result == PARSED && out->value.j_array.size > 0;
+        return result;
+    }
+
+    if (c == '{') {
+        result = project_object(s, p, alive, depth, out);
+        *kept = result == PARSED && out->value.j_object.size > 0;
+        return result;
+    }
+
+    *kept = 0;
+    return skip_value(s);
+}
+
+// Parses the parts of the document that p selects.
+ParseResult parse_projected(Stream *s, Projection *p, Json *out) {
+    uint64_t all = p->count == 64 ? ~(uint64_t)0
+                                  : ((uint64_t)1 << p->count) - 1;
+    int kept;
+    ParseResult result = project_value(s, p, all, 0, out, &kept);
+
+    if (result == PARSED && !kept)
+        out->variant = J_NULL;
+
+    return result;
+}
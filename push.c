@@ -0,0 +1,385 @@
+// Push parsing
+//
+// For input that arrives in pieces, such as from a pipe or a socket. Each
+// piece is fed in as soon as it is there and reported to a JsonHandler as
+// far as it goes. A string, number or keyword cut off at the end of a piece
+// is kept in a buffer until the rest of it arrives, and open containers are
+// kept on an explicit stack instead of the C stack, so nothing depends on
+// how the input is split.
+
+#include <unistd.h>
+
+typedef enum {
+    PUSH_VALUE,
+    // A value or ']'.
+    PUSH_ITEM,
+    // A key or '}'.
+    PUSH_KEY,
+    PUSH_COLON,
+    // ',' or the end of the open container.
+    PUSH_NEXT,
+    PUSH_STRING,
+    PUSH_NUMBER,
+    PUSH_LITERAL,
+    // Only whitespace may follow.
+    PUSH_DONE,
+} PushState;
+
+typedef struct {
+    JsonHandler *handler;
+    PushState state;
+    // '[' or '{' for every open container.
+    List_char stack;
+    // The unfinished token, when it started in an earlier piece.
+    List_char token;
+    int key;
+    int escaped;
+    int backslash;
+    const char *literal;
+    size_t matched;
+    // Bytes fed before the current piece, and where the current token
+    // started.
+    size_t position;
+    size_t token_start;
+    // Position of whatever made the input invalid.
+    size_t error;
+    ParseResult result;
+} PushParser;
+
+PushParser create_push_parser(JsonHandler *h) {
+    return (PushParser){.handler = h,
+                        .stack = create_list_char(16),
+                        .token = create_list_char(64),
+                        .result = NEED_MORE};
+}
+
+void free_push_parser(PushParser *p) {
+    free_list_char(&p->stack);
+    free_list_char(&p->token);
+}
+
+void push_token(PushParser *p, const char *data, size_t size) {
+    List_char *token = &p->token;
+
+    reserve_list_char(token, size);
+    memcpy(token->data + token->size, data, size);
+    token->size += size;
+}
+
+size_t push_error(PushParser *p, size_t i) {
+    p->result = ERROR;
+    p->error = p->position + i;
+    return i;
+}
+
+void push_emitted(PushParser *p, int emitted) {
+    if (!emitted)
+        p->result = ABORTED;
+}
+
+// After a complete value, the container it is in goes on.
+void push_value_done(PushParser *p) {
+    if (p->stack.size > 0) {
+        p->state = PUSH_NEXT;
+    } else {
+        p->state = PUSH_DONE;
+        p->result = PARSED;
+    }
+}
+
+void push_close(PushParser *p) {
+    char open = p->stack.data[--p->stack.size];
+
+    push_emitted(p, open == '[' ? EMIT(p->handler, end_array)
+                                : EMIT(p->handler, end_object));
+    push_value_done(p);
+}
+
+void push_open(PushParser *p, char open) {
+    STATS_DEPTH(p->stack.size + 1);
+    append_list_char(&p->stack, open);
+    push_emitted(p, open == '[' ? EMIT(p->handler, start_array)
+                                : EMIT(p->handler, start_object));
+    p->state = open == '[' ? PUSH_ITEM : PUSH_KEY;
+}
+
+// Reads the token that starts with data[i] or the byte that follows the
+// previous one.
+size_t push_structural(PushParser *p, const char *data, size_t i) {
+    char c = data[i];
+
+    p->token_start = p->position + i;
+    p->token.size = 0;
+
+    switch (p->state) {
+    case PUSH_COLON:
+        if (c != ':')
+            return push_error(p, i);
+
+        p->state = PUSH_VALUE;
+        return i + 1;
+    case PUSH_NEXT:
+        if (c == ',') {
+            p->state = p->stack.data[p->stack.size - 1] == '[' ? PUSH_ITEM
+                                                                : PUSH_KEY;
+            return i + 1;
+        }
+
+        if (c != (p->stack.data[p->stack.size - 1] == '[' ? ']' : '}'))
+            return push_error(p, i);
+
+        push_close(p);
+        return i + 1;
+    case PUSH_DONE:
+        return push_error(p, i);
+    case PUSH_KEY:
+        if (c == '}') {
+            push_close(p);
+            return i + 1;
+        }
+
+        if (c != '"')
+            return push_error(p, i);
+        break;
+    case PUSH_ITEM:
+        if (c == ']') {
+            push_close(p);
+            return i + 1;
+        }
+        break;
+    default:
+        break;
+    }
+
+    switch (c) {
+    case '[':
+    case '{':
+        if (p->stack.size == json_max_depth)
+            return push_error(p, i);
+
+        push_open(p, c);
+        return i + 1;
+    case '"':
+        p->key = p->state == PUSH_KEY;
+        p->escaped = 0;
+        p->backslash = 0;
+        p->state = PUSH_STRING;
+        return i + 1;
+    case 't':
+    case 'f':
+    case 'n':
+        p->literal = c == 't' ? "true" : c == 'f' ? "false" : "null";
+        p->matched = 0;
+        p->state = PUSH_LITERAL;
+        return i;
+    default:
+        if (c != '-' && !is_digit_byte(c))
+            return push_error(p, i);
+
+        p->state = PUSH_NUMBER;
+        return i;
+    }
+}
+
+size_t push_string(PushParser *p, const char *data, size_t size, size_t i) {
+    size_t start = i;
+
+    while (i < size) {
+        if (p->backslash) {
+            p->backslash = 0;
+            i++;
+            continue;
+        }
+
+        i += find_string_special(data + i, size - i);
+
+        if (i == size)
+            break;
+
+        if (data[i] == '\\') {
+            p->backslash = 1;
+            p->escaped = 1;
+            i++;
+            continue;
+        }
+
+        JsonString s = {.data = data + start,
+                        .size = i - start,
+                        .escaped = p->escaped};
+
+        if (p->token.size > 0) {
+            push_token(p, data + start, i - start);
+            s.data = p->token.data;
+            s.size = p->token.size;
+        }
+
+        int escaped;
+        size_t checked = check_json_string(s.data, s.size, &escaped);
+
+        if (checked != s.size) {
+            p->result = ERROR;
+            p->error = p->token_start + 1 + checked;
+            return i;
+        }
+
+        if (p->key) {
+            push_emitted(p, EMIT(p->handler, key, &s));
+            p->state = PUSH_COLON;
+        } else {
+            push_emitted(p, EMIT(p->handler, string, &s));
+            push_value_done(p);
+        }
+
+        return i + 1;
+    }
+
+    push_token(p, data + start, size - start);
+    return size;
+}
+
+// A number ends at the first byte that can't be part of one, so the last one
+// in the input only ends in push_parser_finish.
+void push_number_done(PushParser *p, const char *text, size_t size) {
+    JsonNumber n;
+    size_t used = 0;
+
+    if (!parse_number_text(text, size, &n, &used) || used != size) {
+        p->result = ERROR;
+        p->error = p->token_start + used;
+        return;
+    }
+
+    push_emitted(p, EMIT(p->handler, number, &n));
+    push_value_done(p);
+}
+
+size_t push_number(PushParser *p, const char *data, size_t size, size_t i) {
+    size_t start = i;
+
+    while (i < size && is_number_byte(data[i]))
+        i++;
+
+    if (i == size) {
+        push_token(p, data + start, size - start);
+        return size;
+    }
+
+    if (p->token.size > 0) {
+        push_token(p, data + start, i - start);
+        push_number_done(p, p->token.data, p->token.size);
+    } else {
+        push_number_done(p, data + start, i - start);
+    }
+
+    return i;
+}
+
+size_t push_literal(PushParser *p, const char *data, size_t size, size_t i) {
+    size_t length = strlen(p->literal);
+
+    for (; i < size && p->matched < length; i++, p->matched++)
+        if (data[i] != p->literal[p->matched])
+            return push_error(p, i);
+
+    if (p->matched == length) {
+        switch (p->literal[0]) {
+        case 't':
+            push_emitted(p, EMIT(p->handler, boolean, 1));
+            break;
+        case 'f':
+            push_emitted(p, EMIT(p->handler, boolean, 0));
+            break;
+        default:
+            push_emitted(p, EMIT(p->handler, null));
+            break;
+        }
+
+        push_value_done(p);
+    }
+
+    return i;
+}
+
+// Feeds the next size bytes of input. Returns NEED_MORE until the root value
+// is complete, then PARSED for as long as only whitespace follows. ERROR and
+// ABORTED are final; p->error says where the input went wrong.
+ParseResult push_parser_feed(PushParser *p, const char *data, size_t size) {
+    size_t i = 0;
+
+    while (i < size && (p->result == NEED_MORE || p->result == PARSED)) {
+        switch (p->state) {
+        case PUSH_STRING:
+            i = push_string(p, data, size, i);
+            break;
+        case PUSH_NUMBER:
+            i = push_number(p, data, size, i);
+            break;
+        case PUSH_LITERAL:
+            i = push_literal(p, data, size, i);
+            break;
+        default:
+            i += skip_whitespace(data + i, size - i);
+
+            if (i < size)
+                i = push_structural(p, data, i);
+            break;
+        }
+    }
+
+    p->position += size;
+    return p->result;
+}
+
+// Ends the input. Returns PARSED if it held one complete value.
+ParseResult push_parser_finish(PushParser *p) {
+    if (p->result != NEED_MORE)
+        return p->result;
+
+    if (p->state == PUSH_NUMBER && p->stack.size == 0)
+        push_number_done(p, p->token.data, p->token.size);
+
+    if (p->result == NEED_MORE) {
+        p->result = ERROR;
+        p->error = p->position;
+    }
+
+    return p->result;
+}
+
+#define PUSH_READ_SIZE 65536
+
+// Parses what arrives on fd, handing each read to the parser as soon as it
+// returns rather than waiting for whole chunks. On an error, s becomes a
+// view of the last piece read for display_error to show.
+ParseResult parse_pushed(int fd, JsonHandler *h, Stream *s) {
+    PushParser p = create_push_parser(h);
+    char *piece = malloc(PUSH_READ_SIZE);
+    size_t last = 0;
+    ssize_t n;
+
+    while ((n = read(fd, piece, PUSH_READ_SIZE)) > 0) {
+        last = n;
+
+        if (push_parser_feed(&p, piece, n) != NEED_MORE &&
+            p.result != PARSED)
+            break;
+    }
+
+    ParseResult result = push_parser_finish(&p);
+
+    if (result == ERROR) {
+        size_t end = p.position;
+        size_t start = end - last;
+
+        *s = (Stream){.data = piece,
+                      .current_position = p.error < start ? start : p.error,
+                      .size = end,
+                      .offset = start,
+                      .capacity = last};
+        piece = NULL;
+    }
+
+    free(piece);
+    free_push_parser(&p);
+    return result;
+}
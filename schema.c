@@ -0,0 +1,275 @@
+// Schemas
+//
+// For documents whose shape is known up front. A schema is declared as an
+// X-macro listing its fields, each as FIELD(KIND, name):
+//
+//   #define FRIEND_FIELDS(FIELD) FIELD(INT, id) FIELD(STRING, name)
+//   SCHEMA(Friend, FRIEND_FIELDS)
+//
+// which defines the struct Schema_Friend with one member per field, and
+// parse_schema_Friend to fill it straight from a Stream. KIND is BOOL, INT,
+// DOUBLE, STRING or the name of an earlier schema, with _ARRAY after any of
+// them for an array of those.
+//
+// Keys are compared with the field names in the order they are declared,
+// length first, so a member costs a few integer compares before its value
+// is parsed by the parser for its kind. Members that aren't fields are
+// skipped with skip_value, and null leaves a field zeroed, as is one that
+// is missing. Keys are matched as they appear in the document, escapes
+// included. Anything else goes wrong as it would in parse_json, with the
+// position left where display_error should point.
+
+typedef int Schema_BOOL;
+typedef int64_t Schema_INT;
+typedef double Schema_DOUBLE;
+typedef JsonString Schema_STRING;
+
+ParseResult parse_schema_BOOL(Stream *s, Schema_BOOL *out) {
+    if (eat_literal(s, "true", 4))
+        *out = 1;
+    else if (eat_literal(s, "false", 5))
+        *out = 0;
+    else
+        return ERROR;
+
+    return PARSED;
+}
+
+// A number of the wrong type is reported at its start.
+ParseResult parse_schema_number(Stream *s, JsonNumber *out, int integer) {
+    size_t start = s->current_position;
+    Json n;
+
+    if (parse_number(s, &n) != PARSED)
+        return ERROR;
+
+    if (integer && n.value.j_number.type != NUMBER_INT) {
+        if (start >= s->offset)
+            s->current_position = start;
+
+        return ERROR;
+    }
+
+    *out = n.value.j_number;
+    return PARSED;
+}
+
+ParseResult parse_schema_INT(Stream *s, Schema_INT *out) {
+    JsonNumber n;
+
+    if (parse_schema_number(s, &n, 1) != PARSED)
+        return ERROR;
+
+    *out = n.value;
+    return PARSED;
+}
+
+ParseResult parse_schema_DOUBLE(Stream *s, Schema_DOUBLE *out) {
+    JsonNumber n;
+
+    if (parse_schema_number(s, &n, 0) != PARSED)
+        return ERROR;
+
+    switch (n.type) {
+    case NUMBER_INT:
+        *out = n.value;
+        break;
+    case NUMBER_UINT:
+        *out = n.unsigned_value;
+        break;
+    default:
+        *out = n.double_value;
+        break;
+    }
+
+    return PARSED;
+}
+
+// Like every string parse_json returns, escapes are left for
+// decode_json_string.
+ParseResult parse_schema_STRING(Stream *s, Schema_STRING *out) {
+    Json string;
+
+    if (parse_string(s, &string) != PARSED)
+        return ERROR;
+
+    *out = string.value.j_string;
+    return PARSED;
+}
+
+// Items are parsed one at a time into item and collected on the scratch
+// stack, then committed to the arena at their final size.
+ParseResult parse_schema_array(Stream *s, void *item, size_t item_size,
+                               ParseResult (*parse)(Stream *, void *),
+                               void **data, size_t *size) {
+    Arena *arena = &s->arena;
+    size_t mark = arena_scratch_mark(arena);
+    ParseResult result = PARSED;
+
+    *data = NULL;
+    *size = 0;
+    eat_whitespace(s);
+
+    if (!eat_char(s, '['))
+        return ERROR;
+
+    while (!eat_char_between_whitespace(s, ']')) {
+        if ((result = parse(s, item)) != PARSED)
+            break;
+
+        arena_scratch_push(arena, item, item_size);
+
+        if (!eat_char_between_whitespace(s, ',')) {
+            if (!eat_char_between_whitespace(s, ']'))
+                result = ERROR;
+            break;
+        }
+    }
+
+    if (result != PARSED) {
+        arena_scratch_pop(arena, mark);
+        return result;
+    }
+
+    *size = (arena->scratch_size - mark) / item_size;
+    *data = arena_scratch_commit(arena, mark);
+    return PARSED;
+}
+
+#define SCHEMA_ARRAY(kind)                                                     \
+    typedef struct {                                                           \
+        Schema_##kind *data;                                                   \
+        size_t size;                                                           \
+    } Schema_##kind##_ARRAY;                                                   \
+                                                                               \
+    ParseResult parse_schema_##kind##_item(Stream *s, void *out) {             \
+        return parse_schema_##kind(s, out);                                    \
+    }                                                                          \
+                                                                               \
+    ParseResult parse_schema_##kind##_ARRAY(Stream *s,                         \
+                                            Schema_##kind##_ARRAY *out) {      \
+        Schema_##kind item;                                                    \
+        return parse_schema_array(s, &item, sizeof(item),                      \
+                                  parse_schema_##kind##_item,                  \
+                                  (void **)&out->data, &out->size);            \
+    }
+
+SCHEMA_ARRAY(BOOL)
+SCHEMA_ARRAY(INT)
+SCHEMA_ARRAY(DOUBLE)
+SCHEMA_ARRAY(STRING)
+
+typedef struct {
+    size_t mark;
+    int first;
+    ParseResult result;
+} SchemaObject;
+
+ParseResult schema_start_object(Stream *s, SchemaObject *o) {
+    eat_whitespace(s);
+
+    if (!eat_char(s, '{'))
+        return ERROR;
+
+    *o = (SchemaObject){.mark = arena_scratch_mark(&s->arena),
+                        .first = 1,
+                        .result = PARSED};
+    return PARSED;
+}
+
+// Reads up to the value of the next member. Returns 0 at the end of the
+// object, or on an error, which o->result tells apart. Keys from chunked
+// streams are copied onto the scratch stack and only live until the next
+// call.
+int schema_next_key(Stream *s, SchemaObject *o, JsonString *key) {
+    arena_scratch_pop(&s->arena, o->mark);
+
+    if (o->result != PARSED)
+        return 0;
+
+    if (!o->first && !eat_char_between_whitespace(s, ',')) {
+        if (!eat_char_between_whitespace(s, '}'))
+            o->result = ERROR;
+        return 0;
+    }
+
+    o->first = 0;
+
+    // An empty object, or a trailing comma.
+    if (eat_char_between_whitespace(s, '}'))
+        return 0;
+
+    if (read_string(s, key) != PARSED ||
+        !eat_char_between_whitespace(s, ':')) {
+        o->result = ERROR;
+        return 0;
+    }
+
+    if (s->source != NULL)
+        key->data = s->arena.scratch + o->mark;
+
+    return 1;
+}
+
+#define SCHEMA_MEMBER(kind, name) Schema_##kind name;
+
+#define SCHEMA_MATCH(kind, name)                                               \
+    if (key.size == sizeof(#name) - 1 &&                                       \
+        !memcmp(key.data, #name, sizeof(#name) - 1))                           \
+        o.result = parse_schema_##kind(s, &out->name);                         \
+    else
+
+#define SCHEMA(type, FIELDS)                                                   \
+    typedef struct {                                                           \
+        FIELDS(SCHEMA_MEMBER)                                                  \
+    } Schema_##type;                                                           \
+                                                                               \
+    ParseResult parse_schema_##type(Stream *s, Schema_##type *out) {           \
+        SchemaObject o;                                                        \
+        JsonString key;                                                        \
+                                                                               \
+        memset(out, 0, sizeof(*out));                                          \
+                                                                               \
+        if (schema_start_object(s, &o) != PARSED)                              \
+            return ERROR;                                                      \
+                                                                               \
+        while (schema_next_key(s, &o, &key)) {                                 \
+            if (eat_literal(s, "null", 4))                                     \
+                continue;                                                      \
+                                                                               \
+            FIELDS(SCHEMA_MATCH)                                               \
+            o.result = skip_value(s);                                          \
+        }                                                                      \
+                                                                               \
+        return o.result;                                                       \
+    }                                                                          \
+                                                                               \
+    SCHEMA_ARRAY(type)
+
+// The records in test.json.
+
+#define FRIEND_FIELDS(FIELD) FIELD(INT, id) FIELD(STRING, name)
+
+SCHEMA(Friend, FRIEND_FIELDS)
+
+#define PERSON_FIELDS(FIELD)                                                   \
+    FIELD(STRING, _id)                                                         \
+    FIELD(INT, index)                                                          \
+    FIELD(BOOL, isActive)                                                      \
+    FIELD(STRING, picture)                                                     \
+    FIELD(INT, age)                                                            \
+    FIELD(STRING, eyeColor)                                                    \
+    FIELD(STRING, name)                                                        \
+    FIELD(STRING, gender)                                                      \
+    FIELD(STRING, company)                                                     \
+    FIELD(STRING, email)                                                       \
+    FIELD(STRING, phone)                                                       \
+    FIELD(STRING, address)                                                     \
+    FIELD(STRING, about)                                                       \
+    FIELD(STRING, registered)                                                  \
+    FIELD(STRING_ARRAY, tags)                                                  \
+    FIELD(Friend_ARRAY, friends)                                               \
+    FIELD(STRING, greeting)                                                    \
+    FIELD(STRING, favoriteFruit)
+
+SCHEMA(Person, PERSON_FIELDS)
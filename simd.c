@@ -0,0 +1,423 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+// Scanning kernels used by the parser. Each one has a scalar version and,
+// on x86, SSE2 and AVX2 versions. The best one the CPU supports is picked
+// by init_simd, which main calls before any thread starts; otherwise the
+// first call to a kernel does it, once, even when threads race to it.
+
+static inline int is_whitespace_byte(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+static inline int is_string_special(char c) { return c == '"' || c == '\\'; }
+
+// Bytes that a string can't be copied past without a closer look.
+static inline int is_string_check(char c) {
+    return is_string_special(c) || (unsigned char)c >= 0x80;
+}
+
+static inline int is_skip_special(char c) {
+    return c == '"' || c == '[' || c == ']' || c == '{' || c == '}';
+}
+
+static inline int is_operator_byte(char c) {
+    return c == '{' || c == '}' || c == '[' || c == ']' || c == ':' ||
+           c == ',';
+}
+
+// One bit per byte of a 64-byte block, bit i describing block[i].
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;
+    uint64_t whitespace;
+} BlockMasks;
+
+// Number of whitespace bytes at the start of data.
+size_t skip_whitespace_scalar(const char *data, size_t size) {
+    size_t i = 0;
+
+    while (i < size && is_whitespace_byte(data[i]))
+        ++i;
+
+    return i;
+}
+
+// Index of the first '"' or '\' in data, or size if there is none.
+size_t find_string_special_scalar(const char *data, size_t size) {
+    size_t i = 0;
+
+    while (i < size && !is_string_special(data[i]))
+        ++i;
+
+    return i;
+}
+
+// Index of the first '"', '\' or non-ASCII byte in data, or size if there
+// is none.
+size_t find_string_check_scalar(const char *data, size_t size) {
+    size_t i = 0;
+
+    while (i < size && !is_string_check(data[i]))
+        ++i;
+
+    return i;
+}
+
+// Index of the first quote or bracket in data, or size if there is none.
+size_t find_skip_special_scalar(const char *data, size_t size) {
+    size_t i = 0;
+
+    while (i < size && !is_skip_special(data[i]))
+        ++i;
+
+    return i;
+}
+
+void classify_block_scalar(const char *block, BlockMasks *m) {
+    *m = (BlockMasks){0};
+
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = (uint64_t)1 << i;
+        char c = block[i];
+
+        if (c == '"')
+            m->quote |= bit;
+        else if (c == '\\')
+            m->backslash |= bit;
+        else if (is_operator_byte(c))
+            m->op |= bit;
+        else if (is_whitespace_byte(c))
+            m->whitespace |= bit;
+    }
+}
+
+#ifdef SIMD_X86
+__attribute__((target("sse2"))) size_t
+skip_whitespace_sse2(const char *data, size_t size) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i carriage_return = _mm_set1_epi8('\r');
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i ws = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(block, space),
+                         _mm_cmpeq_epi8(block, newline)),
+            _mm_or_si128(_mm_cmpeq_epi8(block, tab),
+                         _mm_cmpeq_epi8(block, carriage_return)));
+        uint32_t mask = ~(uint32_t)_mm_movemask_epi8(ws) & 0xFFFF;
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + skip_whitespace_scalar(data + i, size - i);
+}
+
+__attribute__((target("sse2"))) size_t
+find_string_special_sse2(const char *data, size_t size) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)));
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + find_string_special_scalar(data + i, size - i);
+}
+
+// Non-ASCII bytes are the ones with the top bit set, which is all movemask
+// looks at.
+__attribute__((target("sse2"))) size_t
+find_string_check_sse2(const char *data, size_t size) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+        uint32_t mask = _mm_movemask_epi8(
+            _mm_or_si128(block, _mm_or_si128(_mm_cmpeq_epi8(block, quote),
+                                             _mm_cmpeq_epi8(block, backslash))));
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + find_string_check_scalar(data + i, size - i);
+}
+
+__attribute__((target("sse2"))) size_t
+find_skip_special_sse2(const char *data, size_t size) {
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8('"')),
+                         _mm_cmpeq_epi8(b, _mm_set1_epi8('['))),
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8(']')),
+                             _mm_cmpeq_epi8(b, _mm_set1_epi8('{'))),
+                _mm_cmpeq_epi8(b, _mm_set1_epi8('}'))));
+        uint32_t mask = _mm_movemask_epi8(special);
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + find_skip_special_scalar(data + i, size - i);
+}
+
+__attribute__((target("sse2"))) void
+classify_block_sse2(const char *block, BlockMasks *m) {
+    *m = (BlockMasks){0};
+
+    for (int i = 0; i < 64; i += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(block + i));
+        __m128i op = _mm_or_si128(
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8('{')),
+                             _mm_cmpeq_epi8(b, _mm_set1_epi8('}'))),
+                _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8('[')),
+                             _mm_cmpeq_epi8(b, _mm_set1_epi8(']')))),
+            _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8(':')),
+                         _mm_cmpeq_epi8(b, _mm_set1_epi8(','))));
+        __m128i ws = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8(' ')),
+                         _mm_cmpeq_epi8(b, _mm_set1_epi8('\n'))),
+            _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8('\t')),
+                         _mm_cmpeq_epi8(b, _mm_set1_epi8('\r'))));
+
+        m->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                        _mm_cmpeq_epi8(b, _mm_set1_epi8('"')))
+                    << i;
+        m->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                            _mm_cmpeq_epi8(b, _mm_set1_epi8('\\')))
+                        << i;
+        m->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << i;
+        m->whitespace |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << i;
+    }
+}
+
+__attribute__((target("avx2"))) size_t
+skip_whitespace_avx2(const char *data, size_t size) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i carriage_return = _mm256_set1_epi8('\r');
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i ws = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, space),
+                            _mm256_cmpeq_epi8(block, newline)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, tab),
+                            _mm256_cmpeq_epi8(block, carriage_return)));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(ws);
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    // GCC doesn't clear the upper halves before calling non-VEX code.
+    _mm256_zeroupper();
+    return i + skip_whitespace_sse2(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) size_t
+find_string_special_avx2(const char *data, size_t size) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+        uint32_t mask = _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, quote),
+                            _mm256_cmpeq_epi8(block, backslash)));
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    _mm256_zeroupper();
+    return i + find_string_special_sse2(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) size_t
+find_string_check_avx2(const char *data, size_t size) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(
+            block, _mm256_or_si256(_mm256_cmpeq_epi8(block, quote),
+                                   _mm256_cmpeq_epi8(block, backslash))));
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    _mm256_zeroupper();
+    return i + find_string_check_sse2(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) size_t
+find_skip_special_avx2(const char *data, size_t size) {
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(b, _mm256_set1_epi8('"')),
+                            _mm256_cmpeq_epi8(b, _mm256_set1_epi8('['))),
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(b, _mm256_set1_epi8(']')),
+                                _mm256_cmpeq_epi8(b, _mm256_set1_epi8('{'))),
+                _mm256_cmpeq_epi8(b, _mm256_set1_epi8('}'))));
+        uint32_t mask = _mm256_movemask_epi8(special);
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    _mm256_zeroupper();
+    return i + find_skip_special_sse2(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) void
+classify_block_avx2(const char *block, BlockMasks *m) {
+    *m = (BlockMasks){0};
+
+    for (int i = 0; i < 64; i += 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i *)(block + i));
+        __m256i op = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(b, _mm256_set1_epi8('{')),
+                                _mm256_cmpeq_epi8(b, _mm256_set1_epi8('}'))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(b, _mm256_set1_epi8('[')),
+                                _mm256_cmpeq_epi8(b, _mm256_set1_epi8(']')))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(b, _mm256_set1_epi8(':')),
+                            _mm256_cmpeq_epi8(b, _mm256_set1_epi8(','))));
+        __m256i ws = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(b, _mm256_set1_epi8(' ')),
+                            _mm256_cmpeq_epi8(b, _mm256_set1_epi8('\n'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(b, _mm256_set1_epi8('\t')),
+                            _mm256_cmpeq_epi8(b, _mm256_set1_epi8('\r'))));
+
+        m->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                        _mm256_cmpeq_epi8(b, _mm256_set1_epi8('"')))
+                    << i;
+        m->backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                            _mm256_cmpeq_epi8(b, _mm256_set1_epi8('\\')))
+                        << i;
+        m->op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << i;
+        m->whitespace |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << i;
+    }
+}
+#endif
+
+typedef enum { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2 } SimdLevel;
+
+SimdLevel detect_simd_level() {
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+
+    if (__builtin_cpu_supports("sse2"))
+        return SIMD_SSE2;
+#endif
+    return SIMD_SCALAR;
+}
+
+size_t resolve_skip_whitespace(const char *data, size_t size);
+size_t resolve_find_string_special(const char *data, size_t size);
+size_t resolve_find_string_check(const char *data, size_t size);
+size_t resolve_find_skip_special(const char *data, size_t size);
+void resolve_classify_block(const char *block, BlockMasks *m);
+
+size_t (*skip_whitespace)(const char *, size_t) = resolve_skip_whitespace;
+size_t (*find_string_special)(const char *, size_t) =
+    resolve_find_string_special;
+size_t (*find_string_check)(const char *, size_t) = resolve_find_string_check;
+size_t (*find_skip_special)(const char *, size_t) = resolve_find_skip_special;
+void (*classify_block)(const char *, BlockMasks *) = resolve_classify_block;
+
+void use_simd_level(SimdLevel level) {
+    skip_whitespace = skip_whitespace_scalar;
+    find_string_special = find_string_special_scalar;
+    find_string_check = find_string_check_scalar;
+    find_skip_special = find_skip_special_scalar;
+    classify_block = classify_block_scalar;
+
+#ifdef SIMD_X86
+    if (level == SIMD_SSE2) {
+        skip_whitespace = skip_whitespace_sse2;
+        find_string_special = find_string_special_sse2;
+        find_string_check = find_string_check_sse2;
+        find_skip_special = find_skip_special_sse2;
+        classify_block = classify_block_sse2;
+    } else if (level == SIMD_AVX2) {
+        skip_whitespace = skip_whitespace_avx2;
+        find_string_special = find_string_special_avx2;
+        find_string_check = find_string_check_avx2;
+        find_skip_special = find_skip_special_avx2;
+        classify_block = classify_block_avx2;
+    }
+#else
+    (void)level;
+#endif
+}
+
+pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+void use_detected_simd_level() { use_simd_level(detect_simd_level()); }
+
+void init_simd() { pthread_once(&simd_once, use_detected_simd_level); }
+
+size_t resolve_skip_whitespace(const char *data, size_t size) {
+    init_simd();
+    return skip_whitespace(data, size);
+}
+
+size_t resolve_find_string_special(const char *data, size_t size) {
+    init_simd();
+    return find_string_special(data, size);
+}
+
+size_t resolve_find_string_check(const char *data, size_t size) {
+    init_simd();
+    return find_string_check(data, size);
+}
+
+size_t resolve_find_skip_special(const char *data, size_t size) {
+    init_simd();
+    return find_skip_special(data, size);
+}
+
+void resolve_classify_block(const char *block, BlockMasks *m) {
+    init_simd();
+    classify_block(block, m);
+}
@@ -0,0 +1,225 @@
+// Snapshots
+//
+// A tape written to a file as it is in memory, so that loading it back is a
+// matter of mapping the file: every tape accessor works on the mapping
+// directly and nothing is parsed or copied. A snapshot is
+//
+//   header  SNAPSHOT_MAGIC, a byte order mark, the number of words and the
+//           size of the string buffer, each 8 bytes
+//   words   the tape's 64-bit words
+//   strings the tape's string buffer, padded to a multiple of 8 bytes
+//
+// Offsets in the tape are relative to its own words and strings, so the
+// file can be mapped anywhere. Snapshots are only read on the kind of
+// machine that wrote them. Loading one checks every word once, so that the
+// accessors can follow its offsets without leaving the mapping.
+
+#define SNAPSHOT_MAGIC "JTSTAPE1"
+#define SNAPSHOT_BYTE_ORDER 0x0102030405060708ULL
+
+typedef struct {
+    char magic[8];
+    uint64_t byte_order;
+    uint64_t words;
+    uint64_t strings;
+} SnapshotHeader;
+
+void tape_append_json(Tape *t, Json *json);
+
+void tape_append_container(Tape *t, Json *json) {
+    size_t start = t->words.size;
+    int object = json->variant == OBJECT;
+
+    tape_append(t, object ? '{' : '[', 0);
+
+    if (object) {
+        for (size_t i = 0; i < json->value.j_object.size; i++) {
+            KeyValuePair *kvp = &json->value.j_object.data[i];
+
+            tape_append_string(t, kvp->key.data, kvp->key.size);
+            tape_append_json(t, kvp->value);
+        }
+    } else {
+        for (size_t i = 0; i < json->value.j_array.size; i++)
+            tape_append_json(t, &json->value.j_array.data[i]);
+    }
+
+    tape_append(t, object ? '}' : ']', start);
+    t->words.data[start] |= t->words.size;
+}
+
+// Flattens a parsed tree onto the end of t.
+void tape_append_json(Tape *t, Json *json) {
+    switch (json->variant) {
+    case OBJECT:
+    case ARRAY:
+        tape_append_container(t, json);
+        break;
+    case STRING:
+        tape_append_string(t, json->value.j_string.data,
+                           json->value.j_string.size);
+        break;
+    case NUMBER:
+        tape_append(t, "lud"[json->value.j_number.type], 0);
+        append_list_uint64_t(&t->words, json->value.j_number.unsigned_value);
+        break;
+    case TRUE:
+        tape_append(t, 't', 0);
+        break;
+    case FALSE:
+        tape_append(t, 'f', 0);
+        break;
+    default:
+        tape_append(t, 'n', 0);
+        break;
+    }
+}
+
+// Returns 0 if the file couldn't be written.
+int write_snapshot(Tape *t, FILE *out) {
+    static const char padding[8] = {0};
+    SnapshotHeader header = {.magic = SNAPSHOT_MAGIC,
+                             .byte_order = SNAPSHOT_BYTE_ORDER,
+                             .words = t->words.size,
+                             .strings = t->strings.size};
+
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(t->words.data, sizeof(uint64_t), t->words.size, out);
+    // A shrunk tape without strings has no buffer for them at all.
+    if (t->strings.size > 0)
+        fwrite(t->strings.data, 1, t->strings.size, out);
+    fwrite(padding, 1, -t->strings.size & 7, out);
+    return !ferror(out);
+}
+
+// Writes t to path. Returns 0 if that failed.
+int save_snapshot(Tape *t, const char *path) {
+    FILE *out = fopen(path, "wb");
+
+    if (out == NULL)
+        return 0;
+
+    int written = write_snapshot(t, out);
+    return fclose(out) == 0 && written;
+}
+
+// Whether the tape holds exactly one value that every accessor can walk:
+// containers nest no deeper than json_max_depth and point at their ends,
+// object keys are strings, strings fit in the string buffer, and numbers
+// have their second word.
+int check_snapshot_tape(Tape *t) {
+    List_size_t open = create_list_size_t(0);
+    size_t size = t->words.size;
+    size_t i = 0;
+    // Whether the next value in the innermost object is a key.
+    int key = 0;
+    int ok = 1;
+
+    while (ok && i < size) {
+        char type = tape_type(t, i);
+        uint64_t payload = tape_payload(t, i);
+        int in_object =
+            open.size > 0 && tape_type(t, open.data[open.size - 1] >> 1) == '{';
+
+        // Nothing may follow the root value.
+        if (i > 0 && open.size == 0)
+            break;
+
+        if (type == '}' || type == ']') {
+            if (open.size == 0)
+                break;
+
+            size_t entry = open.data[--open.size];
+            size_t start = entry >> 1;
+
+            ok = tape_type(t, start) == (type == '}' ? '{' : '[') &&
+                 payload == start && tape_payload(t, start) == i + 1 &&
+                 (type == ']' || key);
+            key = entry & 1;
+            i++;
+        } else if (in_object && key && type != '"') {
+            ok = 0;
+        } else if (type == '{' || type == '[') {
+            if (open.size == json_max_depth)
+                break;
+
+            reserve_list_size_t(&open, 1);
+            open.data[open.size++] = i << 1 | key;
+            key = type == '{';
+            i++;
+            continue;
+        } else if (type == '"') {
+            uint32_t length;
+
+            if (payload > t->strings.size ||
+                t->strings.size - payload < sizeof(length))
+                break;
+
+            memcpy(&length, t->strings.data + payload, sizeof(length));
+            ok = t->strings.size - payload - sizeof(length) > length;
+            i++;
+        } else if (type == 'l' || type == 'u' || type == 'd') {
+            ok = i + 1 < size;
+            i += 2;
+        } else if (type == 't' || type == 'f' || type == 'n') {
+            i++;
+        } else {
+            ok = 0;
+        }
+
+        // A value in an object alternates with its key.
+        if (open.size > 0 && tape_type(t, open.data[open.size - 1] >> 1) == '{')
+            key ^= 1;
+    }
+
+    ok = ok && i == size && open.size == 0;
+    free_list_size_t(&open);
+    return ok;
+}
+
+// Maps the snapshot in fd as t, which is then released with free_tape.
+// Returns 0 if fd doesn't hold one.
+int load_snapshot(int fd, Tape *t) {
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader))
+        return 0;
+
+    size_t size = st.st_size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (data == MAP_FAILED)
+        return 0;
+
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+
+    size_t available = size - sizeof(header);
+
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) ||
+        header.byte_order != SNAPSHOT_BYTE_ORDER || header.words == 0 ||
+        header.words > available / sizeof(uint64_t) ||
+        header.strings > available - header.words * sizeof(uint64_t)) {
+        munmap(data, size);
+        return 0;
+    }
+
+    char *words = data + sizeof(header);
+    char *strings = words + header.words * sizeof(uint64_t);
+
+    *t = (Tape){.words = {.data = (uint64_t *)words,
+                          .size = header.words,
+                          .capacity = header.words},
+                .strings = {.data = strings,
+                            .size = header.strings,
+                            .capacity = header.strings},
+                .mapping = data,
+                .mapping_size = size};
+
+    if (!check_snapshot_tape(t)) {
+        free_tape(t);
+        return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,180 @@
+// Statistics
+//
+// Counters on the hot paths, for finding out why an input is slow without a
+// profiler. They are only compiled in with -DJSON_STATS; otherwise every
+// STATS_ macro is empty and --stats just says so.
+//
+// Every thread counts into its own JsonStats. Threads the parsers start fold
+// theirs into the shared total with STATS_MERGE before they finish, and
+// print_stats adds the calling thread's.
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef JSON_STATS
+
+#include <pthread.h>
+#include <string.h>
+
+#define STATS_LIST_TYPES 16
+
+typedef struct {
+    const char *type;
+    size_t creates;
+    size_t bytes;
+    size_t growths;
+} ListStats;
+
+typedef struct {
+    size_t values;
+    size_t failed_parses;
+    size_t consumes;
+    size_t consumed_bytes;
+    size_t backs;
+    size_t backtracked_bytes;
+    size_t refills;
+    size_t refill_bytes;
+    size_t arena_blocks;
+    size_t arena_bytes;
+    size_t depth;
+    size_t max_depth;
+    ListStats lists[STATS_LIST_TYPES];
+} JsonStats;
+
+_Thread_local JsonStats thread_stats;
+JsonStats total_stats;
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Counters for lists of type, found by name. Types past the table's size
+// share its last entry.
+ListStats *list_stats(JsonStats *stats, const char *type) {
+    int i = 0;
+
+    for (; i < STATS_LIST_TYPES - 1 && stats->lists[i].type != NULL; i++)
+        if (!strcmp(stats->lists[i].type, type))
+            return &stats->lists[i];
+
+    if (stats->lists[i].type == NULL)
+        stats->lists[i].type = type;
+
+    return &stats->lists[i];
+}
+
+void stats_merge() {
+    JsonStats *t = &thread_stats;
+
+    pthread_mutex_lock(&stats_lock);
+
+    // Everything before depth is a plain count.
+    size_t *from = (size_t *)t;
+    size_t *to = (size_t *)&total_stats;
+
+    for (size_t i = 0; i < offsetof(JsonStats, depth) / sizeof(size_t); i++)
+        to[i] += from[i];
+
+    if (t->max_depth > total_stats.max_depth)
+        total_stats.max_depth = t->max_depth;
+
+    for (int i = 0; i < STATS_LIST_TYPES && t->lists[i].type != NULL; i++) {
+        ListStats *l = list_stats(&total_stats, t->lists[i].type);
+
+        l->creates += t->lists[i].creates;
+        l->bytes += t->lists[i].bytes;
+        l->growths += t->lists[i].growths;
+    }
+
+    pthread_mutex_unlock(&stats_lock);
+    memset(t, 0, sizeof(*t));
+}
+
+// Forgets everything counted so far, such as by run_tests.
+void stats_reset() {
+    pthread_mutex_lock(&stats_lock);
+    memset(&total_stats, 0, sizeof(total_stats));
+    pthread_mutex_unlock(&stats_lock);
+    memset(&thread_stats, 0, sizeof(thread_stats));
+}
+
+#define STATS_ADD(counter, amount) (thread_stats.counter += (amount))
+#define STATS_LIST(type, counter, amount)                                      \
+    (list_stats(&thread_stats, #type)->counter += (amount))
+#define STATS_ENTER()                                                          \
+    (++thread_stats.depth > thread_stats.max_depth                            \
+         ? (void)(thread_stats.max_depth = thread_stats.depth)                \
+         : (void)0)
+#define STATS_LEAVE() (thread_stats.depth--)
+#define STATS_DEPTH(d)                                                         \
+    ((d) > thread_stats.max_depth ? (void)(thread_stats.max_depth = (d))      \
+                                  : (void)0)
+#define STATS_MERGE() stats_merge()
+#define STATS_RESET() stats_reset()
+
+// Writes the totals so far, as JSON if json is set.
+void print_stats(FILE *out, size_t input_bytes, int json) {
+    JsonStats *s = &total_stats;
+
+    stats_merge();
+
+    struct {
+        const char *name;
+        size_t value;
+    } counters[] = {
+        {"input_bytes", input_bytes},
+        {"values", s->values},
+        {"failed_parses", s->failed_parses},
+        {"consume_calls", s->consumes},
+        {"consumed_bytes", s->consumed_bytes},
+        {"stream_backs", s->backs},
+        {"backtracked_bytes", s->backtracked_bytes},
+        {"refills", s->refills},
+        {"refill_bytes", s->refill_bytes},
+        {"arena_blocks", s->arena_blocks},
+        {"arena_bytes", s->arena_bytes},
+        {"max_depth", s->max_depth},
+    };
+
+    fputs(json ? "{" : "", out);
+
+    for (size_t i = 0; i < sizeof(counters) / sizeof(*counters); i++) {
+        if (json)
+            fprintf(out, "%s\"%s\": %zu", i ? ", " : "", counters[i].name,
+                    counters[i].value);
+        else
+            fprintf(out, "%-20s %zu\n", counters[i].name, counters[i].value);
+    }
+
+    fputs(json ? ", \"lists\": {" : "", out);
+
+    for (int i = 0; i < STATS_LIST_TYPES && s->lists[i].type != NULL; i++) {
+        ListStats *l = &s->lists[i];
+
+        if (json)
+            fprintf(out,
+                    "%s\"%s\": {\"creates\": %zu, \"bytes\": %zu, "
+                    "\"growths\": %zu}",
+                    i ? ", " : "", l->type, l->creates, l->bytes, l->growths);
+        else
+            fprintf(out, "List_%-15s %zu created, %zu bytes, %zu growths\n",
+                    l->type, l->creates, l->bytes, l->growths);
+    }
+
+    fputs(json ? "}}\n" : "", out);
+}
+
+#else
+
+#define STATS_ADD(counter, amount) ((void)0)
+#define STATS_LIST(type, counter, amount) ((void)0)
+#define STATS_ENTER() ((void)0)
+#define STATS_LEAVE() ((void)0)
+#define STATS_DEPTH(d) ((void)0)
+#define STATS_MERGE() ((void)0)
+#define STATS_RESET() ((void)0)
+
+void print_stats(FILE *out, size_t input_bytes, int json) {
+    (void)input_bytes;
+    (void)json;
+    fputs("stats: not compiled in, build with -DJSON_STATS\n", out);
+}
+
+#endif
@@ -0,0 +1,390 @@
+// Two-stage parser
+//
+// Stage one classifies the input 64 bytes at a time and records the position
+// of every structural character outside of strings, every unescaped quote
+// and the first byte of every number or literal. Stage two walks those
+// positions to build the Json tree, only looking at the bytes of the values
+// themselves.
+//
+// Stage one runs a batch ahead of stage two rather than over the whole input
+// up front, so the positions stay in cache and their memory stays small.
+// Both stages need the whole input in memory, so chunked streams are read to
+// the end first.
+
+#define STRUCTURAL_BATCH_SIZE 65536
+
+LIST(size_t);
+CREATE_LIST(size_t);
+RESERVE_LIST(size_t);
+FREE_LIST(size_t);
+
+// Carried from one block to the next.
+typedef struct {
+    uint64_t in_string;
+    uint64_t escaped;
+    uint64_t scalar;
+} ScanState;
+
+uint64_t prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Bits of the bytes that follow an odd run of backslashes.
+uint64_t find_escaped(uint64_t backslash, uint64_t *carry) {
+    uint64_t escaped = *carry;
+    *carry = 0;
+
+    while (backslash) {
+        int i = __builtin_ctzll(backslash);
+        backslash &= backslash - 1;
+
+        if (escaped >> i & 1)
+            continue;
+
+        if (i == 63)
+            *carry = 1;
+        else
+            escaped |= (uint64_t)1 << (i + 1);
+    }
+
+    return escaped;
+}
+
+void scan_structurals(const char *data, size_t size, size_t base,
+                      ScanState *state, List_size_t *out) {
+    for (size_t i = 0; i < size; i += 64) {
+        const char *block = data + i;
+        char padded[64];
+
+        if (size - i < 64) {
+            memset(padded, ' ', sizeof(padded));
+            memcpy(padded, block, size - i);
+            block = padded;
+        }
+
+        BlockMasks m;
+        classify_block(block, &m);
+
+        uint64_t escaped = find_escaped(m.backslash, &state->escaped);
+        uint64_t quote = m.quote & ~escaped;
+        uint64_t in_string = prefix_xor(quote) ^ state->in_string;
+        state->in_string = (uint64_t)((int64_t)in_string >> 63);
+
+        uint64_t scalar = ~(m.op | m.whitespace | m.quote | in_string);
+        uint64_t scalar_starts = scalar & ~(scalar << 1 | state->scalar);
+        state->scalar = scalar >> 63;
+
+        uint64_t structurals = (m.op & ~in_string) | quote | scalar_starts;
+
+        reserve_list_size_t(out, 64);
+
+        while (structurals) {
+            out->data[out->size++] = base + i + __builtin_ctzll(structurals);
+            structurals &= structurals - 1;
+        }
+    }
+}
+
+// Reads the rest of a chunked stream so that the whole input is in memory.
+void stream_load_all(Stream *s) {
+    if (s->source == NULL)
+        return;
+
+    while (1) {
+        size_t used = s->size - s->offset;
+
+        if (s->capacity - used < s->chunk_size) {
+            s->capacity = s->capacity * 2 + s->chunk_size;
+            s->data = realloc(s->data, s->capacity);
+        }
+
+        size_t read_amount = fread(s->data + used, sizeof(char),
+                                   s->capacity - used, s->source);
+        STATS_ADD(refills, 1);
+        STATS_ADD(refill_bytes, read_amount);
+
+        if (read_amount == 0)
+            break;
+
+        s->size += read_amount;
+    }
+
+    s->source = NULL;
+}
+
+typedef struct {
+    Stream *stream;
+    ScanState state;
+    size_t scanned;
+    size_t *positions;
+    size_t count;
+    size_t next;
+    List_size_t index;
+    size_t depth;
+} IndexWalker;
+
+ParseResult walk_value(IndexWalker *w, Json *out);
+
+// Makes sure the next `ahead` positions are available unless the input ends
+// first. Positions already walked past are dropped.
+void walker_fill(IndexWalker *w, size_t ahead) {
+    Stream *s = w->stream;
+
+    while (w->count - w->next < ahead && w->scanned < s->size) {
+        List_size_t *index = &w->index;
+
+        memmove(index->data, index->data + w->next,
+                sizeof(size_t) * (w->count - w->next));
+        index->size = w->count - w->next;
+
+        size_t batch = s->size - w->scanned < STRUCTURAL_BATCH_SIZE
+                           ? s->size - w->scanned
+                           : STRUCTURAL_BATCH_SIZE;
+        scan_structurals(s->data + (w->scanned - s->offset), batch,
+                         w->scanned, &w->state, index);
+        w->scanned += batch;
+
+        w->positions = index->data;
+        w->count = index->size;
+        w->next = 0;
+    }
+}
+
+ParseResult walker_error(IndexWalker *w, size_t position) {
+    w->stream->current_position = position;
+    return ERROR;
+}
+
+size_t walker_position(IndexWalker *w) {
+    walker_fill(w, 1);
+    return w->next < w->count ? w->positions[w->next] : w->stream->size;
+}
+
+char walker_byte(IndexWalker *w) {
+    walker_fill(w, 1);
+    return w->next < w->count ? stream_byte(w->stream, w->positions[w->next])
+                              : '\0';
+}
+
+// Enters the container at the current position, unless that would nest
+// deeper than json_max_depth.
+int walker_enter(IndexWalker *w) {
+    if (w->depth == json_max_depth)
+        return 0;
+
+    w->depth++;
+    STATS_ENTER();
+    return 1;
+}
+
+void walker_leave(IndexWalker *w) {
+    w->depth--;
+    STATS_LEAVE();
+}
+
+int walker_eat(IndexWalker *w, char c) {
+    if (walker_byte(w) != c)
+        return 0;
+
+    w->next++;
+    return 1;
+}
+
+// The opening quote is the current position, the closing one the next.
+ParseResult walk_string(IndexWalker *w, Json *out) {
+    walker_fill(w, 2);
+    size_t from = w->positions[w->next] + 1;
+
+    if (w->next + 1 >= w->count)
+        return walker_error(w, from - 1);
+
+    size_t to = w->positions[w->next + 1];
+    const char *data = w->stream->data + (from - w->stream->offset);
+    int escaped;
+    size_t checked = check_json_string(data, to - from, &escaped);
+
+    if (checked != to - from)
+        return walker_error(w, from + checked);
+
+    out->variant = STRING;
+    out->value.j_string.data = data;
+    out->value.j_string.size = to - from;
+    out->value.j_string.escaped = escaped;
+    out->value.j_string.id = 0;
+
+    w->next += 2;
+    return PARSED;
+}
+
+// Numbers and literals reuse the stream parsers; anything left between the
+// end of the value and the next structural is an error.
+ParseResult walk_scalar(IndexWalker *w, Json *out) {
+    Stream *s = w->stream;
+    size_t from = w->positions[w->next];
+    JsonParser parser = json_parsers[(unsigned char)stream_byte(s, from)];
+
+    s->current_position = from;
+
+    if (parser == NULL || parser(s, out) != PARSED) {
+        STATS_ADD(failed_parses, 1);
+        return ERROR;
+    }
+
+    w->next++;
+
+    size_t end = s->current_position;
+    size_t limit = walker_position(w);
+    size_t gap = skip_whitespace(s->data + (end - s->offset), limit - end);
+
+    if (end + gap != limit)
+        return walker_error(w, end + gap);
+
+    return PARSED;
+}
+
+ParseResult walk_array(IndexWalker *w, Json *out) {
+    Arena *arena = &w->stream->arena;
+    size_t mark = arena_scratch_mark(arena);
+    ParseResult result = PARSED;
+    Json item;
+
+    if (!walker_enter(w))
+        return walker_error(w, walker_position(w));
+
+    w->next++;
+
+    // A comma may also be followed by the closing bracket, as in
+    // parse_events.
+    while (!walker_eat(w, ']')) {
+        if ((result = walk_value(w, &item)) != PARSED)
+            break;
+
+        arena_scratch_push(arena, &item, sizeof(item));
+
+        if (!walker_eat(w, ',')) {
+            if (!walker_eat(w, ']'))
+                result = walker_error(w, walker_position(w));
+            break;
+        }
+    }
+
+    walker_leave(w);
+
+    if (result != PARSED) {
+        arena_scratch_pop(arena, mark);
+        return result;
+    }
+
+    size_t size = (arena->scratch_size - mark) / sizeof(Json);
+
+    out->variant = ARRAY;
+    out->value.j_array.size = size;
+    out->value.j_array.capacity = size;
+    out->value.j_array.data = arena_scratch_commit(arena, mark);
+    return PARSED;
+}
+
+ParseResult walk_object(IndexWalker *w, Json *out) {
+    Arena *arena = &w->stream->arena;
+    size_t mark = arena_scratch_mark(arena);
+    ParseResult result = PARSED;
+    KeyValuePair kvp;
+    Json key, value;
+
+    if (!walker_enter(w))
+        return walker_error(w, walker_position(w));
+
+    w->next++;
+
+    while (!walker_eat(w, '}')) {
+        if (walker_byte(w) != '"') {
+            result = walker_error(w, walker_position(w));
+            break;
+        }
+
+        if ((result = walk_string(w, &key)) != PARSED)
+            break;
+
+        if (!walker_eat(w, ':')) {
+            result = walker_error(w, walker_position(w));
+            break;
+        }
+
+        if ((result = walk_value(w, &value)) != PARSED)
+            break;
+
+        kvp.key = key.value.j_string;
+
+        if (w->stream->keys != NULL)
+            kvp.key = intern_key(w->stream->keys, kvp.key, 0);
+        kvp.value = arena_copy(arena, &value, sizeof(value));
+        arena_scratch_push(arena, &kvp, sizeof(kvp));
+
+        if (!walker_eat(w, ',')) {
+            if (!walker_eat(w, '}'))
+                result = walker_error(w, walker_position(w));
+            break;
+        }
+    }
+
+    walker_leave(w);
+
+    if (result != PARSED) {
+        arena_scratch_pop(arena, mark);
+        return result;
+    }
+
+    size_t size = (arena->scratch_size - mark) / sizeof(KeyValuePair);
+
+    out->variant = OBJECT;
+    out->value.j_object.size = size;
+    out->value.j_object.data = arena_scratch_commit(arena, mark);
+    out->value.j_object.index = NULL;
+    index_large_object(arena, &out->value.j_object);
+    return PARSED;
+}
+
+ParseResult walk_value(IndexWalker *w, Json *out) {
+    STATS_ADD(values, 1);
+
+    switch (walker_byte(w)) {
+    case '{':
+        return walk_object(w, out);
+    case '[':
+        return walk_array(w, out);
+    case '"':
+        return walk_string(w, out);
+    case '}':
+    case ']':
+    case ':':
+    case ',':
+    case '\0':
+        return walker_error(w, walker_position(w));
+    default:
+        return walk_scalar(w, out);
+    }
+}
+
+ParseResult parse_json_structural(Stream *s, Json *out) {
+    stream_load_all(s);
+
+    // An unclosed string leaves its opening quote as the last position, which
+    // walk_string reports if the walk gets that far.
+    IndexWalker w = {
+        .stream = s,
+        .scanned = s->current_position,
+        .index = create_list_size_t(STRUCTURAL_BATCH_SIZE / 4)};
+    ParseResult result = walk_value(&w, out);
+
+    if (result == PARSED)
+        s->current_position = walker_position(&w);
+
+    free_list_size_t(&w.index);
+    return result;
+}
@@ -0,0 +1,341 @@
+// Tape
+//
+// A document flattened into one array of 64-bit words. The top byte of a
+// word is its type, the low 56 bits its payload:
+//
+//   '{' '['  index of the word after the matching end word
+//   '}' ']'  index of the matching start word
+//   '"'      offset of the string in the string buffer, which holds a 32-bit
+//            length followed by the bytes and a NUL
+//   'l' 'u' 'd'  the next word is the int64, uint64 or double itself
+//   't' 'f' 'n'
+//
+// Object members are a key string followed by the value. The root value
+// starts at index 0. Tapes are built straight from the structural index.
+
+#define TAPE_PAYLOAD_MASK (((uint64_t)1 << 56) - 1)
+
+LIST(uint64_t);
+CREATE_LIST(uint64_t);
+APPEND_LIST(uint64_t);
+SHRINK_LIST(uint64_t);
+FREE_LIST(uint64_t);
+
+// A tape loaded by load_snapshot points into a mapping of the file instead
+// of owning its lists.
+typedef struct {
+    List_uint64_t words;
+    List_char strings;
+    void *mapping;
+    size_t mapping_size;
+} Tape;
+
+Tape create_tape() {
+    return (Tape){.words = create_list_uint64_t(1024),
+                  .strings = create_list_char(4096)};
+}
+
+void free_tape(Tape *t) {
+    if (t->mapping != NULL) {
+        munmap(t->mapping, t->mapping_size);
+        t->mapping = NULL;
+        return;
+    }
+
+    free_list_uint64_t(&t->words);
+    free_list_char(&t->strings);
+}
+
+void tape_append(Tape *t, char type, uint64_t payload) {
+    append_list_uint64_t(&t->words, (uint64_t)(unsigned char)type << 56 |
+                                        (payload & TAPE_PAYLOAD_MASK));
+}
+
+void tape_append_string(Tape *t, const char *data, uint32_t size) {
+    List_char *strings = &t->strings;
+
+    tape_append(t, '"', strings->size);
+    reserve_list_char(strings, sizeof(size) + size + 1);
+
+    memcpy(strings->data + strings->size, &size, sizeof(size));
+    memcpy(strings->data + strings->size + sizeof(size), data, size);
+    strings->data[strings->size + sizeof(size) + size] = '\0';
+    strings->size += sizeof(size) + size + 1;
+}
+
+// Accessors
+
+char tape_type(Tape *t, size_t i) { return t->words.data[i] >> 56; }
+
+uint64_t tape_payload(Tape *t, size_t i) {
+    return t->words.data[i] & TAPE_PAYLOAD_MASK;
+}
+
+// Index of the value following the one at i.
+size_t tape_next(Tape *t, size_t i) {
+    switch (tape_type(t, i)) {
+    case '{':
+    case '[':
+        return tape_payload(t, i);
+    case 'l':
+    case 'u':
+    case 'd':
+        return i + 2;
+    default:
+        return i + 1;
+    }
+}
+
+JsonNumber tape_number(Tape *t, size_t i) {
+    JsonNumber n;
+
+    switch (tape_type(t, i)) {
+    case 'l':
+        n.type = NUMBER_INT;
+        break;
+    case 'u':
+        n.type = NUMBER_UINT;
+        break;
+    default:
+        assert(tape_type(t, i) == 'd');
+        n.type = NUMBER_DOUBLE;
+        break;
+    }
+
+    n.unsigned_value = t->words.data[i + 1];
+    return n;
+}
+
+const char *tape_string(Tape *t, size_t i, size_t *size) {
+    assert(tape_type(t, i) == '"');
+    const char *s = t->strings.data + tape_payload(t, i);
+    uint32_t length;
+
+    memcpy(&length, s, sizeof(length));
+
+    if (size != NULL)
+        *size = length;
+
+    return s + sizeof(length);
+}
+
+// Number of items in the array, or members in the object, at i.
+size_t tape_size(Tape *t, size_t i) {
+    size_t end = tape_payload(t, i) - 1;
+    size_t count = 0;
+
+    for (size_t item = i + 1; item < end; item = tape_next(t, item))
+        ++count;
+
+    return tape_type(t, i) == '{' ? count / 2 : count;
+}
+
+// Index of the value stored under key in the object at i, or 0 if there is
+// no such member.
+size_t tape_find_key(Tape *t, size_t i, const char *key) {
+    assert(tape_type(t, i) == '{');
+    size_t end = tape_payload(t, i) - 1;
+    size_t key_size = strlen(key);
+
+    for (size_t item = i + 1; item < end;) {
+        size_t size;
+        const char *k = tape_string(t, item, &size);
+
+        if (size == key_size && !memcmp(k, key, size))
+            return item + 1;
+
+        item = tape_next(t, item + 1);
+    }
+
+    return 0;
+}
+
+// Building
+
+ParseResult tape_walk_value(IndexWalker *w, Tape *t);
+
+ParseResult tape_walk_string(IndexWalker *w, Tape *t) {
+    walker_fill(w, 2);
+    size_t from = w->positions[w->next] + 1;
+
+    if (w->next + 1 >= w->count)
+        return walker_error(w, from - 1);
+
+    size_t to = w->positions[w->next + 1];
+    const char *data = w->stream->data + (from - w->stream->offset);
+    int escaped;
+    size_t checked = check_json_string(data, to - from, &escaped);
+
+    if (checked != to - from)
+        return walker_error(w, from + checked);
+
+    tape_append_string(t, data, to - from);
+
+    w->next += 2;
+    return PARSED;
+}
+
+ParseResult tape_walk_container(IndexWalker *w, Tape *t, char open,
+                                char close) {
+    size_t start = t->words.size;
+    ParseResult result = PARSED;
+
+    if (!walker_enter(w))
+        return walker_error(w, walker_position(w));
+
+    tape_append(t, open, 0);
+    w->next++;
+
+    // As in walk_array, a comma may also be followed by the closing
+    // bracket.
+    while (!walker_eat(w, close)) {
+        if (open == '{') {
+            if (walker_byte(w) != '"') {
+                result = walker_error(w, walker_position(w));
+                break;
+            }
+
+            if ((result = tape_walk_string(w, t)) != PARSED)
+                break;
+
+            if (!walker_eat(w, ':')) {
+                result = walker_error(w, walker_position(w));
+                break;
+            }
+        }
+
+        if ((result = tape_walk_value(w, t)) != PARSED)
+            break;
+
+        if (!walker_eat(w, ',')) {
+            if (!walker_eat(w, close))
+                result = walker_error(w, walker_position(w));
+            break;
+        }
+    }
+
+    walker_leave(w);
+
+    if (result != PARSED)
+        return result;
+
+    tape_append(t, close, start);
+    t->words.data[start] |= t->words.size;
+    return PARSED;
+}
+
+ParseResult tape_walk_value(IndexWalker *w, Tape *t) {
+    Json scalar;
+    ParseResult result;
+
+    switch (walker_byte(w)) {
+    case '{':
+        return tape_walk_container(w, t, '{', '}');
+    case '[':
+        return tape_walk_container(w, t, '[', ']');
+    case '"':
+        return tape_walk_string(w, t);
+    case '}':
+    case ']':
+    case ':':
+    case ',':
+    case '\0':
+        return walker_error(w, walker_position(w));
+    }
+
+    if ((result = walk_scalar(w, &scalar)) != PARSED)
+        return result;
+
+    switch (scalar.variant) {
+    case NUMBER:
+        tape_append(t, "lud"[scalar.value.j_number.type], 0);
+        append_list_uint64_t(&t->words, scalar.value.j_number.unsigned_value);
+        break;
+    case TRUE:
+        tape_append(t, 't', 0);
+        break;
+    case FALSE:
+        tape_append(t, 'f', 0);
+        break;
+    default:
+        tape_append(t, 'n', 0);
+        break;
+    }
+
+    return PARSED;
+}
+
+ParseResult parse_tape(Stream *s, Tape *t) {
+    stream_load_all(s);
+
+    IndexWalker w = {
+        .stream = s,
+        .scanned = s->current_position,
+        .index = create_list_size_t(STRUCTURAL_BATCH_SIZE / 4)};
+    ParseResult result = tape_walk_value(&w, t);
+
+    if (result == PARSED) {
+        s->current_position = walker_position(&w);
+        shrink_list_uint64_t(&t->words);
+        shrink_list_char(&t->strings);
+    }
+
+    free_list_size_t(&w.index);
+    return result;
+}
+
+// Strings on a tape aren't interned, so their id is 0.
+JsonString tape_json_string(Tape *t, size_t i) {
+    JsonString s = {0};
+
+    s.data = tape_string(t, i, &s.size);
+    s.escaped = memchr(s.data, '\\', s.size) != NULL;
+    return s;
+}
+
+// Replays the value at i as events. Returns 0 if the handler aborted.
+int emit_tape(Tape *t, size_t i, JsonHandler *h) {
+    size_t end;
+    JsonString s;
+    JsonNumber n;
+
+    switch (tape_type(t, i)) {
+    case '{':
+        if (!EMIT(h, start_object))
+            return 0;
+
+        end = tape_payload(t, i) - 1;
+        for (size_t item = i + 1; item < end; item = tape_next(t, item + 1)) {
+            s = tape_json_string(t, item);
+
+            if (!EMIT(h, key, &s) || !emit_tape(t, item + 1, h))
+                return 0;
+        }
+
+        return EMIT(h, end_object);
+    case '[':
+        if (!EMIT(h, start_array))
+            return 0;
+
+        end = tape_payload(t, i) - 1;
+        for (size_t item = i + 1; item < end; item = tape_next(t, item))
+            if (!emit_tape(t, item, h))
+                return 0;
+
+        return EMIT(h, end_array);
+    case '"':
+        s = tape_json_string(t, i);
+        return EMIT(h, string, &s);
+    case 'l':
+    case 'u':
+    case 'd':
+        n = tape_number(t, i);
+        return EMIT(h, number, &n);
+    case 't':
+        return EMIT(h, boolean, 1);
+    case 'f':
+        return EMIT(h, boolean, 0);
+    default:
+        return EMIT(h, null);
+    }
+}
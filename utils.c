@@ -1,4 +1,5 @@
 #include "list.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -9,6 +10,8 @@
 LIST(char);
 CREATE_LIST(char);
 APPEND_LIST(char);
+RESERVE_LIST(char);
+SHRINK_LIST(char);
 FREE_LIST(char);
 FILTER_LIST(char);
 
@@ -41,3 +44,95 @@ int whitespace(char *c) {
         return 0;
     }
 }
+
+int hex_digit_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Writes code_point as UTF-8 and returns the number of bytes used.
+int utf8_encode(unsigned int code_point, char *out) {
+    if (code_point < 0x80) {
+        out[0] = code_point;
+        return 1;
+    }
+
+    if (code_point < 0x800) {
+        out[0] = 0xC0 | (code_point >> 6);
+        out[1] = 0x80 | (code_point & 0x3F);
+        return 2;
+    }
+
+    if (code_point < 0x10000) {
+        out[0] = 0xE0 | (code_point >> 12);
+        out[1] = 0x80 | ((code_point >> 6) & 0x3F);
+        out[2] = 0x80 | (code_point & 0x3F);
+        return 3;
+    }
+
+    out[0] = 0xF0 | (code_point >> 18);
+    out[1] = 0x80 | ((code_point >> 12) & 0x3F);
+    out[2] = 0x80 | ((code_point >> 6) & 0x3F);
+    out[3] = 0x80 | (code_point & 0x3F);
+    return 4;
+}
+
+// Length of the UTF-8 sequence at p, or 0 if it is cut off after size bytes
+// or isn't valid: overlong forms, surrogates and anything past U+10FFFF are
+// not.
+int utf8_length(const unsigned char *p, size_t size) {
+    int length;
+    unsigned char low = 0x80, high = 0xBF;
+
+    if (p[0] < 0x80)
+        return 1;
+
+    if (p[0] >= 0xC2 && p[0] <= 0xDF) {
+        length = 2;
+    } else if (p[0] >= 0xE0 && p[0] <= 0xEF) {
+        length = 3;
+        if (p[0] == 0xE0)
+            low = 0xA0;
+        else if (p[0] == 0xED)
+            high = 0x9F;
+    } else if (p[0] >= 0xF0 && p[0] <= 0xF4) {
+        length = 4;
+        if (p[0] == 0xF0)
+            low = 0x90;
+        else if (p[0] == 0xF4)
+            high = 0x8F;
+    } else {
+        return 0;
+    }
+
+    if (size < (size_t)length || p[1] < low || p[1] > high)
+        return 0;
+
+    for (int i = 2; i < length; i++)
+        if ((p[i] & 0xC0) != 0x80)
+            return 0;
+
+    return length;
+}
+
+// Hashes eight bytes at a time; the tail is read as one zero-padded word.
+uint64_t hash_bytes(const char *data, size_t size) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ size;
+    uint64_t word;
+
+    for (; size >= 8; data += 8, size -= 8) {
+        memcpy(&word, data, 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+
+    word = 0;
+    memcpy(&word, data, size);
+    h = (h ^ word) * 0xC4CEB9FE1A85EC53ull;
+    return h ^ h >> 29;
+}
@@ -0,0 +1,267 @@
+// Writer
+//
+// Serializes events into a buffer that is handed to fwrite whenever it
+// fills up, so output costs a memcpy per token rather than a printf. Indent
+// 0 writes compact JSON, anything else puts every item on its own line,
+// indented by that many spaces per level.
+//
+// A writer without a file keeps everything in its buffer, growing it as
+// needed, until the caller takes the output.
+
+#define WRITER_BUFFER_SIZE (1 << 20)
+#define WRITER_MEMORY_SIZE (1 << 16)
+
+typedef struct {
+    FILE *out;
+    char *data;
+    size_t size;
+    size_t capacity;
+    int indent;
+    size_t depth;
+    int first;
+    int after_key;
+} Writer;
+
+Writer create_writer(FILE *out, int indent) {
+    size_t capacity = out != NULL ? WRITER_BUFFER_SIZE : WRITER_MEMORY_SIZE;
+
+    return (Writer){.out = out,
+                    .data = malloc(capacity),
+                    .capacity = capacity,
+                    .indent = indent};
+}
+
+void writer_flush(Writer *w) {
+    if (w->out == NULL)
+        return;
+
+    fwrite(w->data, 1, w->size, w->out);
+    w->size = 0;
+}
+
+void free_writer(Writer *w) {
+    writer_flush(w);
+    free(w->data);
+}
+
+// Drops everything written after `size`, such as a document that turned out
+// to be invalid. Only possible while it is still in the buffer.
+void writer_truncate(Writer *w, size_t size) {
+    assert(size <= w->size);
+    w->size = size;
+    w->depth = 0;
+    w->first = 0;
+    w->after_key = 0;
+}
+
+void writer_write(Writer *w, const char *data, size_t size) {
+    if (w->size + size > w->capacity) {
+        if (w->out == NULL) {
+            while (w->size + size > w->capacity)
+                w->capacity *= 2;
+
+            w->data = realloc(w->data, w->capacity);
+        } else {
+            writer_flush(w);
+
+            if (size > w->capacity) {
+                fwrite(data, 1, size, w->out);
+                return;
+            }
+        }
+    }
+
+    memcpy(w->data + w->size, data, size);
+    w->size += size;
+}
+
+void writer_byte(Writer *w, char c) {
+    if (w->size == w->capacity) {
+        writer_write(w, &c, 1);
+        return;
+    }
+
+    w->data[w->size++] = c;
+}
+
+void writer_newline(Writer *w) {
+    static const char spaces[64] = "                                "
+                                   "                                ";
+    size_t width = w->indent * w->depth;
+
+    writer_byte(w, '\n');
+
+    for (; width > sizeof(spaces); width -= sizeof(spaces))
+        writer_write(w, spaces, sizeof(spaces));
+
+    writer_write(w, spaces, width);
+}
+
+void writer_control(Writer *w, unsigned char c) {
+    char escape[6] = {'\\', 'u', '0', '0', "0123456789abcdef"[c >> 4],
+                      "0123456789abcdef"[c & 0xF]};
+
+    writer_write(w, escape, sizeof(escape));
+}
+
+// Writes text that is already in its escaped form, as JsonStrings are, only
+// escaping the control characters the parser lets through.
+void writer_string(Writer *w, const char *data, size_t size) {
+    size_t start = 0;
+
+    writer_byte(w, '"');
+
+    for (size_t i = 0; i < size; i++) {
+        if ((unsigned char)data[i] >= 0x20)
+            continue;
+
+        writer_write(w, data + start, i - start);
+        writer_control(w, data[i]);
+        start = i + 1;
+    }
+
+    writer_write(w, data + start, size - start);
+    writer_byte(w, '"');
+}
+
+// Writes raw text, such as a decoded string, as a JSON string.
+void writer_escaped(Writer *w, const char *data, size_t size) {
+    size_t start = 0;
+
+    writer_byte(w, '"');
+
+    for (size_t i = 0; i < size; i++) {
+        unsigned char c = data[i];
+        char escape = 0;
+
+        switch (c) {
+        case '"':
+        case '\\':
+            escape = c;
+            break;
+        case '\b':
+            escape = 'b';
+            break;
+        case '\f':
+            escape = 'f';
+            break;
+        case '\n':
+            escape = 'n';
+            break;
+        case '\r':
+            escape = 'r';
+            break;
+        case '\t':
+            escape = 't';
+            break;
+        }
+
+        if (escape == 0 && c >= 0x20)
+            continue;
+
+        writer_write(w, data + start, i - start);
+        start = i + 1;
+
+        if (escape) {
+            char pair[2] = {'\\', escape};
+            writer_write(w, pair, 2);
+        } else {
+            writer_control(w, c);
+        }
+    }
+
+    writer_write(w, data + start, size - start);
+    writer_byte(w, '"');
+}
+
+// Comma and line break before a value, unless it follows its key.
+void writer_item(Writer *w) {
+    if (w->after_key) {
+        w->after_key = 0;
+        return;
+    }
+
+    if (w->depth == 0)
+        return;
+
+    if (!w->first)
+        writer_byte(w, ',');
+
+    if (w->indent)
+        writer_newline(w);
+
+    w->first = 0;
+}
+
+int writer_open(Writer *w, char c) {
+    writer_item(w);
+    writer_byte(w, c);
+    w->depth++;
+    w->first = 1;
+    return 1;
+}
+
+int writer_close(Writer *w, char c) {
+    w->depth--;
+
+    if (!w->first && w->indent)
+        writer_newline(w);
+
+    writer_byte(w, c);
+    w->first = 0;
+    return 1;
+}
+
+int writer_start_object(void *w) { return writer_open(w, '{'); }
+int writer_end_object(void *w) { return writer_close(w, '}'); }
+int writer_start_array(void *w) { return writer_open(w, '['); }
+int writer_end_array(void *w) { return writer_close(w, ']'); }
+
+int writer_key(void *context, JsonString *key) {
+    Writer *w = context;
+
+    writer_item(w);
+    writer_string(w, key->data, key->size);
+    writer_write(w, ": ", w->indent ? 2 : 1);
+    w->after_key = 1;
+    return 1;
+}
+
+int writer_json_string(void *w, JsonString *value) {
+    writer_item(w);
+    writer_string(w, value->data, value->size);
+    return 1;
+}
+
+int writer_number(void *w, JsonNumber *value) {
+    char number[32];
+
+    writer_item(w);
+    writer_write(w, number, format_number(value, number));
+    return 1;
+}
+
+int writer_boolean(void *w, int value) {
+    writer_item(w);
+    writer_write(w, value ? "true" : "false", value ? 4 : 5);
+    return 1;
+}
+
+int writer_null(void *w) {
+    writer_item(w);
+    writer_write(w, "null", 4);
+    return 1;
+}
+
+JsonHandler writer_handler(Writer *w) {
+    return (JsonHandler){.context = w,
+                         .start_object = writer_start_object,
+                         .end_object = writer_end_object,
+                         .start_array = writer_start_array,
+                         .end_array = writer_end_array,
+                         .key = writer_key,
+                         .string = writer_json_string,
+                         .number = writer_number,
+                         .boolean = writer_boolean,
+                         .null = writer_null};
+}